@@ -35,6 +35,17 @@
 
 #include "aes.h"
 
+// Building with -DSNOW_VI_NO_AESNI forces the portable round, as in
+// the reference model.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+  !defined(SNOW_VI_NO_AESNI)
+#define AES_NI_AVAILABLE 1
+#include <stdatomic.h>
+#include <immintrin.h>
+#else
+#define AES_NI_AVAILABLE 0
+#endif
+
 
 
 //u8 AesKey1[16] = { 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
@@ -138,11 +149,54 @@ void shift_rows(u8 *state) {
     }
 }
 
+#if AES_NI_AVAILABLE
+// With an all zero round key aesenc is exactly the keyless round.
+__attribute__((target("aes")))
+static void AESRound_NI(u8 *in, u8 *out) {
+
+    __m128i state = _mm_loadu_si128((const __m128i *) in);
+    state = _mm_aesenc_si128(state, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *) out, state);
+}
+
+__attribute__((target("aes")))
+static void AESRound_NI_x2(u8 *in0, u8 *out0, u8 *in1, u8 *out1) {
+
+    __m128i s0 = _mm_loadu_si128((const __m128i *) in0);
+    __m128i s1 = _mm_loadu_si128((const __m128i *) in1);
+    s0 = _mm_aesenc_si128(s0, _mm_setzero_si128());
+    s1 = _mm_aesenc_si128(s1, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *) out0, s0);
+    _mm_storeu_si128((__m128i *) out1, s1);
+}
+
+// Returns non-zero if the CPU has AES-NI. The CPU is queried on the
+// first call only, 0 in aes_ni_state means not yet known.
+static atomic_int aes_ni_state;
+
+static int AES_NI_Usable(void) {
+
+    int state = atomic_load_explicit(&aes_ni_state, memory_order_relaxed);
+    if (state == 0) {
+        state = __builtin_cpu_supports("aes") ? 1 : 2;
+        atomic_store_explicit(&aes_ni_state, state, memory_order_relaxed);
+    }
+    return state == 1;
+}
+#endif
+
 void AESRound(u8 *in, u8 *out) {
 
     u8 state[4 * 4];
     u8  i, j;
 
+#if AES_NI_AVAILABLE
+    if (AES_NI_Usable()) {
+        AESRound_NI(in, out);
+        return;
+    }
+#endif
+
     for (i = 0; i < 4; i++) {
         for (j = 0; j < 4; j++) {
             state[4*i + j] = in[i + 4 * j];
@@ -157,3 +211,23 @@ void AESRound(u8 *in, u8 *out) {
         }
     }
 }
+
+// Two independent rounds in one call. The outputs may alias the inputs.
+void AESRound_x2(u8 *in0, u8 *out0, u8 *in1, u8 *out1) {
+
+    u8 tmp[16];
+    u8 i;
+
+#if AES_NI_AVAILABLE
+    if (AES_NI_Usable()) {
+        AESRound_NI_x2(in0, out0, in1, out1);
+        return;
+    }
+#endif
+
+    AESRound(in0, tmp);
+    AESRound(in1, out1);
+    for (i = 0; i < 16; i++) {
+        out0[i] = tmp[i];
+    }
+}
@@ -40,6 +40,7 @@
 
 
 void AESRound(u8 *in, u8 *out);
+void AESRound_x2(u8 *in0, u8 *out0, u8 *in1, u8 *out1);
 
 
 #endif /* aes_h */
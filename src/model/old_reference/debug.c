@@ -60,8 +60,8 @@ void print_lfsr(char *name, LFSR r) {
     if (name) {
         printf("%s: ", name);
     }
-    for(int idx = 0; idx < 32; idx ++) {
-        printf("%02x ", r.b[idx]);
+    for(int idx = 0; idx < 16; idx ++) {
+        printf("%02x %02x ", LFSR_S(r, idx) & 0xff, LFSR_S(r, idx) >> 8);
     }
     printf("\n");
 }
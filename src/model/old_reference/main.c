@@ -33,6 +33,7 @@
 // =====================================================================
 
 #include <stdio.h>
+#include <string.h>
 #include "typeconst.h"
 #include "snow_vi.h"
 #include "debug.h"
@@ -80,6 +81,7 @@ const uint8_t iv[][16] = {
 
 
 void SNOW_Vi_Testvectors(void) {
+    SNOW_Vi_Ctx ctx;
     int testidx;
     int i;
 
@@ -90,12 +92,12 @@ void SNOW_Vi_Testvectors(void) {
         print_u8("iv:  ", iv[testidx], 16);
 	printf("\n");
 
-        SNOW_Vi_Init(key[testidx], iv[testidx]);
+        SNOW_Vi_Init(&ctx, key[testidx], iv[testidx]);
 	printf("\n");
 
         printf("Output keystream: \n");
         for(i = 0; i < 8; i++) {
-            u128 z = SNOW_Vi_Keystream();
+            u128 z = SNOW_Vi_Keystream(&ctx);
             print_128(0, z);
         }
 	printf("\n");
@@ -104,11 +106,50 @@ void SNOW_Vi_Testvectors(void) {
 }
 
 
+/*
+ Check that two contexts used in turn give the same keystreams
+ as each context used alone, i.e. that they share no state.
+ */
+int SNOW_Vi_Interleaved(void) {
+    SNOW_Vi_Ctx ctx[2];
+    u128 ref[2][8];
+    u8 iv2[16];
+    const u8 *ivs[2] = {iv[0], iv2};
+    int i, j;
+
+    for (i = 0; i < 16; i++) {
+        iv2[i] = iv[0][15 - i];
+    }
+
+    for (j = 0; j < 2; j++) {
+        SNOW_Vi_Init(&ctx[0], key[0], ivs[j]);
+        for (i = 0; i < 8; i++) {
+            ref[j][i] = SNOW_Vi_Keystream(&ctx[0]);
+        }
+    }
+
+    SNOW_Vi_Init(&ctx[0], key[0], ivs[0]);
+    SNOW_Vi_Init(&ctx[1], key[0], ivs[1]);
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 2; j++) {
+            u128 z = SNOW_Vi_Keystream(&ctx[j]);
+            if (memcmp(z.b, ref[j][i].b, 16) != 0) {
+                printf("Interleaved contexts: mismatch in context %d, word %d.\n", j, i);
+                return 1;
+            }
+        }
+    }
+
+    printf("Interleaved contexts: ok.\n");
+    return 0;
+}
+
+
 int main(int argc, const char * argv[]) {
 
   //    SNOW_V_Testvectors();
 
     SNOW_Vi_Testvectors();
 
-    return 0;
+    return SNOW_Vi_Interleaved();
 }
@@ -37,11 +37,11 @@
 #include "aes.h"
 #include "debug.h"
 
-#define INTERNAL_DEBUG 0
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-static LFSR A, B;
-static u128 r1, r2, r3, z;
-static u128 t1, t2;
+#define INTERNAL_DEBUG 0
 
 static const int sigma[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
 
@@ -50,169 +50,216 @@ static const int WORK_MODE = 0;
 
 
 
-static void print_state(void) {
+static void print_state(const SNOW_Vi_Ctx *ctx) {
 
-  print_lfsr("lfsr_a",A);
-  print_lfsr("lsfr_b",B);
+  print_lfsr("lfsr_a",ctx->A);
+  print_lfsr("lsfr_b",ctx->B);
   printf("\n");
 
-  print_128("r1",r1);
-  print_128("r2",r2);
-  print_128("r3",r3);
+  print_128("r1",ctx->r1);
+  print_128("r2",ctx->r2);
+  print_128("r3",ctx->r3);
   printf("\n");
 
-  print_128("t1",t1);
-  print_128("t2",t2);
+  print_128("t1",ctx->t1);
+  print_128("t2",ctx->t2);
   printf("\n");
 
-  print_128("z ",z);
+  print_128("z ",ctx->z);
   printf("\n");
 }
 
 
-static void clearR123(void) {
+static void clearR123(SNOW_Vi_Ctx *ctx) {
     for(int i = 0; i < 4; i++) {
-        r1.w[i] = 0;
-        r2.w[i] = 0;
-        r3.w[i] = 0;
+        ctx->r1.w[i] = 0;
+        ctx->r2.w[i] = 0;
+        ctx->r3.w[i] = 0;
     }
 }
 
-static u16 MULx(u16 V, u16 c)  //Multiply with c
-{
-    if (V & 0x8000)
-        return(V << 1) ^ c;
-    else
-        return (V << 1);
-}
-
 
 
-
-static void CalcOutput(void) {
+static void CalcOutput(SNOW_Vi_Ctx *ctx) {
     for(int idx = 0; idx < 4; idx++) {
-        z.w[idx] = (t1.w[idx] + r1.w[idx]) ^ r2.w[idx];
+        ctx->z.w[idx] = (ctx->t1.w[idx] + ctx->r1.w[idx]) ^ ctx->r2.w[idx];
     }
 }
 
 
-static void CalcTaps(void) {
+static void CalcTaps(SNOW_Vi_Ctx *ctx) {
     //T1,T2 from LFSR1 and LFSR2
-    t1.w[0] = B.w[4];
-    t1.w[1] = B.w[5];
-    t1.w[2] = B.w[6];
-    t1.w[3] = B.w[7];
-
-    t2.w[0] = A.w[4];
-    t2.w[1] = A.w[5];
-    t2.w[2] = A.w[6];
-    t2.w[3] = A.w[7];
+    for(int idx = 0; idx < 8; idx++) {
+        ctx->t1.s[idx] = LFSR_S(ctx->B, idx + 8);
+        ctx->t2.s[idx] = LFSR_S(ctx->A, idx + 8);
+    }
 }
 
 
-static void LoadLFSR(const u8 *K, const u8 *IV)
+static void LoadLFSR(SNOW_Vi_Ctx *ctx, const u8 *K, const u8 *IV)
 {
     for (int idx = 0; idx < 16; idx++)
     {
-        A.b[idx]      = IV[idx];
-        A.b[idx + 16] = K[idx];
+        ctx->A.b[idx]      = IV[idx];
+        ctx->A.b[idx + 16] = K[idx];
 
-        B.b[idx]      = 0x00;
-        B.b[idx + 16] = K[idx + 16];
+        ctx->B.b[idx]      = 0x00;
+        ctx->B.b[idx + 16] = K[idx + 16];
 
     }
-    CalcTaps();
+#if defined(SNOW_VI_LFSR_RING)
+    ctx->A.head = 0;
+    ctx->B.head = 0;
+#endif
+    CalcTaps(ctx);
 }
 
 
-static void ClockLFSR_Step(void) //the update of the LFSR
+// Eight steps of the LFSR update. All taps of the eight feedback words
+// are in the current state, so they are computed in parallel and the
+// upper halves (h[1]) move down to the lower halves (h[0]).
+//
+// With the ring buffer layout each step instead overwrites the oldest
+// word with the new one and advances the head.
+#if defined(SNOW_VI_LFSR_RING) || !defined(__SSE2__)
+static u16 MULx(u16 V, u16 c)  //Multiply with c, branch free
 {
-    u16 u = MULx(A.s[0],0x4a6d) ^ A.s[7] ^ B.s[0];
-    u16 v = MULx(B.s[0],0xcc87) ^ B.s[8] ^ A.s[0];
+    u16 mask = (u16) (0 - (V >> 15));
+    return (u16) (V << 1) ^ (c & mask);
+}
+#endif
 
-    for(int idx = 0; idx < 15; idx++) {
-        A.s[idx] = A.s[idx + 1];
-        B.s[idx] = B.s[idx + 1];
+#if defined(SNOW_VI_LFSR_RING)
+static void ClockLFSR_Step(SNOW_Vi_Ctx *ctx)
+{
+    u16 u = MULx(LFSR_S(ctx->A, 0),0x4a6d) ^ LFSR_S(ctx->A, 7) ^ LFSR_S(ctx->B, 0);
+    u16 v = MULx(LFSR_S(ctx->B, 0),0xcc87) ^ LFSR_S(ctx->B, 8) ^ LFSR_S(ctx->A, 0);
+
+    LFSR_S(ctx->A, 0) = u;
+    LFSR_S(ctx->B, 0) = v;
+    ctx->A.head = (ctx->A.head + 1) & 0x0f;
+    ctx->B.head = (ctx->B.head + 1) & 0x0f;
+}
+
+static void ClockLFSR_8Steps(SNOW_Vi_Ctx *ctx)
+{
+    for(int idx = 0; idx < 8; idx++) {
+        ClockLFSR_Step(ctx);
     }
-    A.s[15] = u;
-    B.s[15] = v;
+}
+#elif defined(__SSE2__)
+static inline __m128i MULx_x8(__m128i V, __m128i c)
+{
+    __m128i mask = _mm_srai_epi16(V, 15);
+    return _mm_xor_si128(_mm_slli_epi16(V, 1), _mm_and_si128(c, mask));
 }
 
-static void ClockLFSRMode(int mode){
+static void ClockLFSR_8Steps(SNOW_Vi_Ctx *ctx)
+{
+    __m128i a_lo = _mm_loadu_si128((const __m128i *) ctx->A.h[0].b);
+    __m128i a_hi = _mm_loadu_si128((const __m128i *) ctx->A.h[1].b);
+    __m128i b_lo = _mm_loadu_si128((const __m128i *) ctx->B.h[0].b);
+    __m128i b_hi = _mm_loadu_si128((const __m128i *) ctx->B.h[1].b);
+
+    // A.s[7..14]
+    __m128i a_7 = _mm_or_si128(_mm_srli_si128(a_lo, 14), _mm_slli_si128(a_hi, 2));
+
+    __m128i u = _mm_xor_si128(MULx_x8(a_lo, _mm_set1_epi16(0x4a6d)),
+                              _mm_xor_si128(a_7, b_lo));
+    __m128i v = _mm_xor_si128(MULx_x8(b_lo, _mm_set1_epi16((short) 0xcc87)),
+                              _mm_xor_si128(b_hi, a_lo));
+
+    _mm_storeu_si128((__m128i *) ctx->A.h[0].b, a_hi);
+    _mm_storeu_si128((__m128i *) ctx->B.h[0].b, b_hi);
+    _mm_storeu_si128((__m128i *) ctx->A.h[1].b, u);
+    _mm_storeu_si128((__m128i *) ctx->B.h[1].b, v);
+}
+#else
+static void ClockLFSR_8Steps(SNOW_Vi_Ctx *ctx)
+{
+    u16 u[8], v[8];
 
-    for (int idx = 0; idx < 8; idx++) {
-        ClockLFSR_Step();
+    for(int idx = 0; idx < 8; idx++) {
+        u[idx] = MULx(ctx->A.s[idx],0x4a6d) ^ ctx->A.s[idx + 7] ^ ctx->B.s[idx];
+        v[idx] = MULx(ctx->B.s[idx],0xcc87) ^ ctx->B.s[idx + 8] ^ ctx->A.s[idx];
+    }
+    ctx->A.h[0] = ctx->A.h[1];
+    ctx->B.h[0] = ctx->B.h[1];
+    for(int idx = 0; idx < 8; idx++) {
+        ctx->A.s[idx + 8] = u[idx];
+        ctx->B.s[idx + 8] = v[idx];
     }
+}
+#endif
+
+static void ClockLFSRMode(SNOW_Vi_Ctx *ctx, int mode){
+
+    ClockLFSR_8Steps(ctx);
     if (mode == INIT_MODE) {
         for(int idx = 0; idx < 8; idx++) {
-            A.s[idx+8] = A.s[idx+8] ^ z.s[idx];
+            LFSR_S(ctx->A, idx+8) = LFSR_S(ctx->A, idx+8) ^ ctx->z.s[idx];
         }
     }
-    CalcTaps();
+    CalcTaps(ctx);
 }
 
 
-static void ClockFSM(void)
+static void ClockFSM(SNOW_Vi_Ctx *ctx)
 {
     u128 next_r1;
-    u128 aes_out;
 
     for (int idx = 0; idx < 4; idx++) {
-        next_r1.w[idx] = ((t2.w[idx] ^ r3.w[idx]) + r2.w[idx]);
+        next_r1.w[idx] = ((ctx->t2.w[idx] ^ ctx->r3.w[idx]) + ctx->r2.w[idx]);
     }
 
-    AESRound(r2.b, aes_out.b); //The second AES round
-    for (int idx = 0; idx < 16; idx++) {
-        r3.b[idx] = aes_out.b[idx];
-    }
+    // The second (r2 -> r3) and first (r1 -> r2) AES rounds are
+    // independent and issued together.
+    AESRound_x2(ctx->r2.b, ctx->r3.b, ctx->r1.b, ctx->r2.b);
 
-    AESRound(r1.b,aes_out.b);  //The first AES round
     for (int idx = 0; idx < 16; idx++) {
-        r2.b[idx] = aes_out.b[idx];
-    }
-
-    for (int idx = 0; idx < 16; idx++) {
-        r1.b[idx] = next_r1.b[sigma[idx]];
+        ctx->r1.b[idx] = next_r1.b[sigma[idx]];
     }
 
 }
 
 
-void SNOW_Vi_Init(const u8 * key, const u8 * iv) {
+void SNOW_Vi_Init(SNOW_Vi_Ctx *ctx, const u8 * key, const u8 * iv) {
 
-    clearR123();
-    LoadLFSR(key, iv);
-    CalcOutput();
+    clearR123(ctx);
+    LoadLFSR(ctx, key, iv);
+    CalcOutput(ctx);
 
-    printf("State after loading:\n");
-    print_state();
+    if (INTERNAL_DEBUG) {
+        printf("State after loading:\n");
+        print_state(ctx);
+    }
 
-//    for (i = 0 ; i<16 ; i++)
-//    {
-//        CalcOutput();
-//        ClockFSM();
-//        ClockLFSRMode(INIT_MODE);
-//        if (i>=14) {
-//            for (int idx = 0; idx < 16; idx++) {
-//                r1.b[idx] = r1.b[idx] ^ key[idx + ((i-14)<<4)];
-//            }
-//        }
-//        if (INTERNAL_DEBUG){
-//            printf("---- State after initialization round %d (of 16) : ----\n", i+1);
-//            print_state();
-//        }
-//    }
+    for (int i = 0 ; i<16 ; i++)
+    {
+        CalcOutput(ctx);
+        ClockFSM(ctx);
+        ClockLFSRMode(ctx, INIT_MODE);
+        if (i>=14) {
+            for (int idx = 0; idx < 16; idx++) {
+                ctx->r1.b[idx] = ctx->r1.b[idx] ^ key[idx + ((i-14)<<4)];
+            }
+        }
+        if (INTERNAL_DEBUG){
+            printf("---- State after initialization round %d (of 16) : ----\n", i+1);
+            print_state(ctx);
+        }
+    }
 
 }
 
 
-u128 SNOW_Vi_Keystream(void) {
-    CalcOutput();
-    ClockFSM();
-    ClockLFSRMode(WORK_MODE);
+u128 SNOW_Vi_Keystream(SNOW_Vi_Ctx *ctx) {
+    CalcOutput(ctx);
+    ClockFSM(ctx);
+    ClockLFSRMode(ctx, WORK_MODE);
 
     if (INTERNAL_DEBUG) {
-        print_state();
+        print_state(ctx);
     }
-    return z;
+    return ctx->z;
 }
@@ -39,7 +39,17 @@
 #include <stdio.h>
 #include "typeconst.h"
 
-void SNOW_Vi_Init(const u8 * key, const u8 * iv);
-u128 SNOW_Vi_Keystream(void);
+// The complete cipher state of one stream. Each stream, or thread,
+// uses its own context.
+typedef struct SNOW_Vi_State
+{
+    LFSR A, B;
+    u128 r1, r2, r3, z;
+    u128 t1, t2;
+
+} SNOW_Vi_Ctx;
+
+void SNOW_Vi_Init(SNOW_Vi_Ctx *ctx, const u8 * key, const u8 * iv);
+u128 SNOW_Vi_Keystream(SNOW_Vi_Ctx *ctx);
 
 #endif /* snow_vi_h */
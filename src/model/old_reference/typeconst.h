@@ -54,6 +54,22 @@ typedef union FSMR
 } u128;
 
 
+#if defined(SNOW_VI_LFSR_RING)
+// Ring buffer layout, word i of the LFSR is in s[(head + i) & 15].
+typedef struct LFSR_R
+{
+    union {
+        u128 h[2];
+        u32 w[8];
+        u16 s[16];
+        u8 b[32];
+    };
+    u8 head;
+
+} LFSR;
+
+#define LFSR_S(r, i) ((r).s[((r).head + (i)) & 0x0f])
+#else
 typedef union LFSR_U
 {
     u128 h[2];
@@ -63,4 +79,7 @@ typedef union LFSR_U
 
 } LFSR;
 
+#define LFSR_S(r, i) ((r).s[(i)])
+#endif
+
 #endif /* typeconst_h */
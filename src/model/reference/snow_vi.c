@@ -35,20 +35,28 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //=======================================================================
 
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
 #include "snow_vi.h"
+#include "snow_vi_cpu.h"
+#include "snow_vi_aes_round.h"
+
+#if SNOW_VI_X86 || SNOW_VI_SSE2
+#include <immintrin.h>
+#endif
 
 static const uint8_t sigma[16] = {0, 4, 8, 12, 1, 5, 9, 13,
 				  2, 6, 10, 14, 3, 7, 11, 15};
 
 
+// Multiply a by x in GF(2^16), where b is the reduction constant of
+// the field polynomial. Branch free, the mask is all ones if the msb
+// of a is set.
 uint16_t gmul(uint16_t a, uint16_t b) {
-  if (a & 0x8000) {
-    return (a << 1) ^ b;
-  }
-  else {
-    return (a  << 1);
-  }
+  uint16_t mask = (uint16_t) (0 - (a >> 15));
+
+  return (uint16_t) (a << 1) ^ (b & mask);
 }
 
 
@@ -58,121 +66,607 @@ uint16_t u8_u16(uint8_t lsb, uint8_t msb) {
 }
 
 
-void update_t1_t2(struct snow_vi_ctx *ctx) {
-  for (int i = 0 ; i < 8 ; i++) {
-    ctx->t1[i] = ctx->lfsr_b[i + 8];
-    ctx->t2[i] = ctx->lfsr_a[i + 8];
+// Get 32-bit word i from an array of 16-bit words, little-endian first.
+static inline uint32_t u16_u32(const uint16_t *w, int i) {
+  return (uint32_t) w[2 * i] | ((uint32_t) w[(2 * i) + 1] << 16);
+}
+
+
+// Access word i of lfsr_a and lfsr_b in either state layout.
+#if defined(SNOW_VI_LFSR_RING)
+#define LFSR_A(ctx, i) ((ctx)->lfsr_a[((ctx)->lfsr_head + (i)) & 0x0f])
+#define LFSR_B(ctx, i) ((ctx)->lfsr_b[((ctx)->lfsr_head + (i)) & 0x0f])
+#else
+#define LFSR_A(ctx, i) ((ctx)->lfsr_a[(i)])
+#define LFSR_B(ctx, i) ((ctx)->lfsr_b[(i)])
+#endif
+
+
+// The taps t1 and t2 are read in place from the upper halves of lfsr_b
+// and lfsr_a. In the ring layout the head is a multiple of eight between
+// keystream steps, so the halves are contiguous in both layouts.
+static inline const uint16_t *tap_t1(const struct snow_vi_ctx *ctx) {
+  return &LFSR_B(ctx, 8);
+}
+
+
+static inline const uint16_t *tap_t2(const struct snow_vi_ctx *ctx) {
+  return &LFSR_A(ctx, 8);
+}
+
+
+// Clock the LFSRs eight steps. The feedback words for step k are
+// u = gmul(a[k]) ^ a[k + 7] ^ b[k] and v = gmul(b[k]) ^ b[k + 8] ^ a[k],
+// and all taps are in the current state for k < 8. So the eight new
+// words of each LFSR can be computed in parallel and the update
+// becomes a move of the upper half to the lower half.
+#if defined(SNOW_VI_LFSR_RING)
+// One step on the ring buffers. The new word replaces word 0, which
+// becomes word 15 when the head is advanced.
+static inline void update_lfsr_step(struct snow_vi_ctx *ctx) {
+  uint16_t u = gmul(LFSR_A(ctx, 0), 0x4a6d) ^ LFSR_A(ctx, 7) ^ LFSR_B(ctx, 0);
+  uint16_t v = gmul(LFSR_B(ctx, 0), 0xcc87) ^ LFSR_B(ctx, 8) ^ LFSR_A(ctx, 0);
+
+  LFSR_A(ctx, 0) = u;
+  LFSR_B(ctx, 0) = v;
+  ctx->lfsr_head = (ctx->lfsr_head + 1) & 0x0f;
+}
+
+
+static void update_lfsr_ring(struct snow_vi_ctx *ctx) {
+  for (int k = 0 ; k < 8 ; k++) {
+    update_lfsr_step(ctx);
+  }
+}
+
+#elif !SNOW_VI_SSE2
+static void update_lfsr_generic(struct snow_vi_ctx *ctx) {
+  uint16_t u[8];
+  uint16_t v[8];
+
+  for (int k = 0 ; k < 8 ; k++) {
+    u[k] = gmul(ctx->lfsr_a[k], 0x4a6d) ^ ctx->lfsr_a[k + 7] ^ ctx->lfsr_b[k];
+    v[k] = gmul(ctx->lfsr_b[k], 0xcc87) ^ ctx->lfsr_b[k + 8] ^ ctx->lfsr_a[k];
+  }
+
+  for (int k = 0 ; k < 8 ; k++) {
+    ctx->lfsr_a[k] = ctx->lfsr_a[k + 8];
+    ctx->lfsr_b[k] = ctx->lfsr_b[k + 8];
+    ctx->lfsr_a[k + 8] = u[k];
+    ctx->lfsr_b[k + 8] = v[k];
   }
 }
 
 
+#else
+// gmul() on eight 16-bit lanes.
+static inline __m128i gmul_x8(__m128i a, __m128i b) {
+  __m128i mask = _mm_srai_epi16(a, 15);
+
+  return _mm_xor_si128(_mm_slli_epi16(a, 1), _mm_and_si128(b, mask));
+}
+
+
+static void update_lfsr_sse2(struct snow_vi_ctx *ctx) {
+  __m128i a_lo = _mm_loadu_si128((const __m128i *) &ctx->lfsr_a[0]);
+  __m128i a_hi = _mm_loadu_si128((const __m128i *) &ctx->lfsr_a[8]);
+  __m128i b_lo = _mm_loadu_si128((const __m128i *) &ctx->lfsr_b[0]);
+  __m128i b_hi = _mm_loadu_si128((const __m128i *) &ctx->lfsr_b[8]);
+  __m128i a_7, u, v;
+
+  // a[7..14]
+  a_7 = _mm_or_si128(_mm_srli_si128(a_lo, 14), _mm_slli_si128(a_hi, 2));
+
+  u = _mm_xor_si128(gmul_x8(a_lo, _mm_set1_epi16(0x4a6d)),
+		    _mm_xor_si128(a_7, b_lo));
+  v = _mm_xor_si128(gmul_x8(b_lo, _mm_set1_epi16((short) 0xcc87)),
+		    _mm_xor_si128(b_hi, a_lo));
+
+  _mm_storeu_si128((__m128i *) &ctx->lfsr_a[0], a_hi);
+  _mm_storeu_si128((__m128i *) &ctx->lfsr_b[0], b_hi);
+  _mm_storeu_si128((__m128i *) &ctx->lfsr_a[8], u);
+  _mm_storeu_si128((__m128i *) &ctx->lfsr_b[8], v);
+}
+#endif
+
+
 void update_lfsr(struct snow_vi_ctx *ctx) {
-  uint16_t u;
-  uint16_t v;
+#if defined(SNOW_VI_LFSR_RING)
+  update_lfsr_ring(ctx);
+#elif SNOW_VI_SSE2
+  update_lfsr_sse2(ctx);
+#else
+  update_lfsr_generic(ctx);
+#endif
+}
 
-  u = gmul(ctx->lfsr_a[0], 0x4a6d) ^ ctx->lfsr_a[7] ^ ctx->lfsr_b[0];
-  v = gmul(ctx->lfsr_b[0], 0xcc87) ^ ctx->lfsr_b[8] ^ ctx->lfsr_a[0];
 
-  for (int i = 0 ; i < 15 ; i++) {
-    ctx->lfsr_a[i] = ctx->lfsr_a[i + 1];
-    ctx->lfsr_b[i] = ctx->lfsr_b[i + 1];
+// Portable FSM update:
+// r1 = sigma((t2 ^ r3) + r2), r2 = aes(r1), r3 = aes(r2)
+static void update_fsm_generic(struct snow_vi_ctx *ctx) {
+  uint32_t next_r1[4];
+  uint8_t *src = (uint8_t *) next_r1;
+  uint8_t *dst = (uint8_t *) ctx->r1;
+
+  for (int i = 0 ; i < 4 ; i++) {
+    next_r1[i] = (u16_u32(tap_t2(ctx), i) ^ ctx->r3[i]) + ctx->r2[i];
+  }
+
+  aes_round_x2((uint8_t *) ctx->r2, (uint8_t *) ctx->r3,
+	       (uint8_t *) ctx->r1, (uint8_t *) ctx->r2);
+
+  for (int i = 0 ; i < 16 ; i++) {
+    dst[i] = src[sigma[i]];
   }
+}
+
+
+#if SNOW_VI_X86
+// The 32-bit lane additions as one SIMD add, and sigma as one byte
+// shuffle.
+__attribute__((target("ssse3")))
+static inline __m128i fsm_next_r1(__m128i t2, __m128i r2, __m128i r3) {
+  const __m128i sigma_mask = _mm_loadu_si128((const __m128i *) sigma);
+
+  return _mm_shuffle_epi8(_mm_add_epi32(_mm_xor_si128(t2, r3), r2), sigma_mask);
+}
+
+
+// FSM update with the AES rounds done by whatever backend aes_round_x2()
+// selects.
+__attribute__((target("ssse3")))
+static void update_fsm_ssse3(struct snow_vi_ctx *ctx) {
+  __m128i t2 = _mm_loadu_si128((const __m128i *) tap_t2(ctx));
+  __m128i r2 = _mm_loadu_si128((const __m128i *) ctx->r2);
+  __m128i r3 = _mm_loadu_si128((const __m128i *) ctx->r3);
+  __m128i r1 = fsm_next_r1(t2, r2, r3);
 
-  ctx->lfsr_a[15] = u;
-  ctx->lfsr_b[15] = v;
+  aes_round_x2((uint8_t *) ctx->r2, (uint8_t *) ctx->r3,
+	       (uint8_t *) ctx->r1, (uint8_t *) ctx->r2);
+  _mm_storeu_si128((__m128i *) ctx->r1, r1);
+}
+
+
+// FSM update with everything kept in registers.
+__attribute__((target("ssse3,aes")))
+static void update_fsm_aesni(struct snow_vi_ctx *ctx) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i t2 = _mm_loadu_si128((const __m128i *) tap_t2(ctx));
+  __m128i r1 = _mm_loadu_si128((const __m128i *) ctx->r1);
+  __m128i r2 = _mm_loadu_si128((const __m128i *) ctx->r2);
+  __m128i r3 = _mm_loadu_si128((const __m128i *) ctx->r3);
+  __m128i next_r1 = fsm_next_r1(t2, r2, r3);
+
+  r3 = _mm_aesenc_si128(r2, zero);
+  r2 = _mm_aesenc_si128(r1, zero);
+
+  _mm_storeu_si128((__m128i *) ctx->r1, next_r1);
+  _mm_storeu_si128((__m128i *) ctx->r2, r2);
+  _mm_storeu_si128((__m128i *) ctx->r3, r3);
+}
+#endif
+
+
+enum fsm_backend {FSM_UNRESOLVED, FSM_AESNI, FSM_SSSE3, FSM_GENERIC};
+
+// The FSM backend for this CPU, resolved on the first call so that the
+// CPU is not queried for every block. A switch rather than a function
+// pointer keeps the backends inlined into the block loops.
+static atomic_int fsm_backend;
+
+static int fsm_backend_select(void) {
+#if SNOW_VI_X86
+  if (snow_vi_cpu_has_aesni() && snow_vi_cpu_has_ssse3()) {
+    return FSM_AESNI;
+  }
+
+  if (snow_vi_cpu_has_ssse3()) {
+    return FSM_SSSE3;
+  }
+#endif
+
+  return FSM_GENERIC;
 }
 
 
 void update_fsm(struct snow_vi_ctx *ctx) {
-//  uint8_t next_r1[16];;
-//  uint8_t aes_in[16];
-//  uint8_t aes_out[16];
-//
-//    for (int i = 0; i < 16; i++) {
-//        next_r1[i] = ((ctx->t2[i] ^ ctx->r3[idx]) + r2.w[idx]);
-//    }
-//
-//    AESRound(r2.b, aes_out.b); //The second AES round
-//    for (int idx = 0; idx < 16; idx++) {
-//        r3.b[idx] = aes_out.b[idx];
-//    }
-//
-//    AESRound(r1.b,aes_out.b);  //The first AES round
-//    for (int idx = 0; idx < 16; idx++) {
-//        r2.b[idx] = aes_out.b[idx];
-//    }
-//
-//    for (int idx = 0; idx < 16; idx++) {
-//        r1.b[idx] = next_r1.b[sigma[idx]];
-//    }
+  int backend = atomic_load_explicit(&fsm_backend, memory_order_relaxed);
+
+  if (backend == FSM_UNRESOLVED) {
+    backend = fsm_backend_select();
+    atomic_store_explicit(&fsm_backend, backend, memory_order_relaxed);
+  }
+
+  switch (backend) {
+#if SNOW_VI_X86
+  case FSM_AESNI:
+    update_fsm_aesni(ctx);
+    break;
+
+  case FSM_SSSE3:
+    update_fsm_ssse3(ctx);
+    break;
+#endif
+
+  default:
+    update_fsm_generic(ctx);
+  }
 }
 
 
-void gen_z(struct snow_vi_ctx *ctx) {
-  for (int i = 0 ; i < 8 ; i++) {
-    ctx->z[i] = (ctx->t1[i] + ctx->r1[i]) ^ ctx->r2[i];
+// z = (t1 + r1) ^ r2, stored as 16 bytes.
+void gen_z(const struct snow_vi_ctx *ctx, uint8_t *z) {
+  uint32_t words[4];
+
+  for (int i = 0 ; i < 4 ; i++) {
+    words[i] = (u16_u32(tap_t1(ctx), i) + ctx->r1[i]) ^ ctx->r2[i];
   }
+
+  memcpy(z, words, 16);
 }
 
 
-void snow_vi_init(struct snow_vi_ctx *ctx, const uint8_t *key, const uint8_t *iv) {
-  ctx->initialized = 0;
+#if SNOW_VI_SSE2
+// gen_z() returning z in a register.
+static inline __m128i gen_z_sse2(const struct snow_vi_ctx *ctx) {
+  __m128i t1 = _mm_loadu_si128((const __m128i *) tap_t1(ctx));
+  __m128i r1 = _mm_loadu_si128((const __m128i *) ctx->r1);
+  __m128i r2 = _mm_loadu_si128((const __m128i *) ctx->r2);
+
+  return _mm_xor_si128(_mm_add_epi32(t1, r1), r2);
+}
+#endif
+
+
+// Update to the next state.
+static inline void clock_state(struct snow_vi_ctx *ctx) {
+  update_fsm(ctx);
+  update_lfsr(ctx);
+}
+
+
+// Lower half of lfsr_b in the AEAD mode, the words b0 to b7 of the
+// constant defined for SNOW-V.
+static const uint16_t aead_b_low[8] = {0x6c41, 0x7865, 0x6b45, 0x2064,
+				       0x694a, 0x676e, 0x6854, 0x6d6f};
+
+static const uint16_t zero_b_low[8] = {0};
+
+
+// Load the key and iv and run the 16 initialization rounds. In each
+// round the output z is fed back into the upper half of lfsr_a, and
+// in the last two rounds the two halves of the key are added to r1.
+static void init_state(struct snow_vi_ctx *ctx, const uint8_t *key, const uint8_t *iv,
+		       const uint16_t *b_low) {
+  uint8_t z[16];
+
+#if defined(SNOW_VI_LFSR_RING)
+  ctx->lfsr_head = 0;
+#endif
+  ctx->ks_pos = 0;
 
   // Load lfsr_a and lfsr_b with key and iv bytes, little endian order.
   for (int i = 0 ; i < 8 ; i++) {
     ctx->lfsr_a[i] = u8_u16(iv[(2 * i)], iv[(2 * i) + 1]);
     ctx->lfsr_a[i + 8] = u8_u16(key[(2 * i)], key[(2 * i) + 1]);
 
-    ctx->lfsr_b[i] = 0x00;
+    ctx->lfsr_b[i] = b_low[i];
     ctx->lfsr_b[i + 8] = u8_u16(key[(2 * i) + 16], key[(2 * i) + 17]);
   }
 
-  update_t1_t2(ctx);
-
-  for (int i = 0 ; i < 8 ; i++) {
+  for (int i = 0 ; i < 4 ; i++) {
     ctx->r1[i] = 0;
     ctx->r2[i] = 0;
     ctx->r3[i] = 0;
   }
 
-  gen_z(ctx);
+  for (int i = 0 ; i < 16 ; i++) {
+    gen_z(ctx, z);
+    clock_state(ctx);
+
+    for (int j = 0 ; j < 8 ; j++) {
+      LFSR_A(ctx, j + 8) ^= u8_u16(z[(2 * j)], z[(2 * j) + 1]);
+    }
+
+    if (i >= 14) {
+      const uint8_t *k = &key[16 * (i - 14)];
+
+      for (int j = 0 ; j < 4 ; j++) {
+	ctx->r1[j] ^= ((uint32_t) u8_u16(k[(4 * j) + 2], k[(4 * j) + 3]) << 16) |
+	  u8_u16(k[(4 * j)], k[(4 * j) + 1]);
+      }
+    }
+  }
+}
+
+
+void snow_vi_init(struct snow_vi_ctx *ctx, const uint8_t *key, const uint8_t *iv) {
+  init_state(ctx, key, iv, zero_b_low);
+}
 
-  //  snow_vi_next(ctx);
 
-  ctx->initialized = 1;
+void snow_vi_init_aead(struct snow_vi_ctx *ctx, const uint8_t *key, const uint8_t *iv) {
+  init_state(ctx, key, iv, aead_b_low);
 }
 
 
-// Update to the next state.
-void snow_vi_next(struct snow_vi_ctx *ctx) {
+void snow_vi_derive_iv(const uint8_t *iv_base, uint64_t seq, uint8_t *iv) {
+  memcpy(iv, iv_base, 16);
   for (int i = 0 ; i < 8 ; i++) {
-    update_lfsr(ctx);
+    iv[15 - i] ^= (uint8_t) (seq >> (8 * i));
+  }
+}
+
+
+int snow_vi_check_iv_base(const uint8_t *iv_base) {
+  uint8_t bits = 0;
+
+  for (int i = 8 ; i < 16 ; i++) {
+    bits |= iv_base[i];
+  }
+  return (bits == 0) ? 0 : -1;
+}
+
+
+// memset() called through a volatile pointer cannot be removed as a
+// dead store.
+static void *(*const volatile wipe_memset)(void *, int, size_t) = memset;
+
+void snow_vi_wipe(void *buf, size_t len) {
+  wipe_memset(buf, 0, len);
+}
+
+
+// Write the next len bytes of keystream to out. A partially consumed
+// block is not buffered. The state is left on that block with ks_pos
+// as the offset into it, and the remaining bytes are regenerated from
+// the state by the next call.
+void snow_vi_keystream(struct snow_vi_ctx *ctx, uint8_t *out, size_t len) {
+  uint8_t z[16];
+
+  if (ctx->ks_pos != 0) {
+    size_t n = 16 - ctx->ks_pos;
+
+    if (n > len) {
+      n = len;
+    }
+
+    gen_z(ctx, z);
+    memcpy(out, &z[ctx->ks_pos], n);
+    out += n;
+    len -= n;
+    ctx->ks_pos = (uint8_t) ((ctx->ks_pos + n) & 15);
+
+    if (ctx->ks_pos != 0) {
+      return;
+    }
+    clock_state(ctx);
+  }
+
+  while (len >= 16) {
+    gen_z(ctx, out);
+    clock_state(ctx);
+    out += 16;
+    len -= 16;
+  }
+
+  if (len != 0) {
+    gen_z(ctx, z);
+    memcpy(out, z, len);
+    ctx->ks_pos = (uint8_t) len;
+  }
+}
+
+
+// XOR n full keystream blocks into in and write the result to out.
+// With stream set, out must be 16 byte aligned and is written with
+// non-temporal stores.
+#if SNOW_VI_SSE2
+static void xor_blocks(struct snow_vi_ctx *ctx, const uint8_t *in, uint8_t *out,
+		       size_t n, int stream) {
+  size_t i = 0;
+
+  if (stream) {
+    // Blocks up to the first cache line boundary are stored normally.
+    // After that each line is read completely before it is streamed,
+    // so that a line is never read again after a partial non-temporal
+    // store, which would flush the write-combining buffer. This
+    // matters when in and out are the same buffer.
+    for ( ; (i < n) && (((uintptr_t) &out[16 * i] & 63) != 0) ; i++) {
+      __m128i d = _mm_loadu_si128((const __m128i *) &in[16 * i]);
+
+      _mm_storeu_si128((__m128i *) &out[16 * i], _mm_xor_si128(d, gen_z_sse2(ctx)));
+      clock_state(ctx);
+    }
+
+    for ( ; i + 4 <= n ; i += 4) {
+      __m128i d[4];
+
+      for (int j = 0 ; j < 4 ; j++) {
+	d[j] = _mm_loadu_si128((const __m128i *) &in[16 * (i + j)]);
+      }
+      for (int j = 0 ; j < 4 ; j++) {
+	d[j] = _mm_xor_si128(d[j], gen_z_sse2(ctx));
+	clock_state(ctx);
+      }
+      for (int j = 0 ; j < 4 ; j++) {
+	_mm_stream_si128((__m128i *) &out[16 * (i + j)], d[j]);
+      }
+    }
+    _mm_sfence();
+  }
+
+  for ( ; i < n ; i++) {
+    __m128i d = _mm_loadu_si128((const __m128i *) &in[16 * i]);
+
+    _mm_storeu_si128((__m128i *) &out[16 * i], _mm_xor_si128(d, gen_z_sse2(ctx)));
+    clock_state(ctx);
   }
+}
 
-  if (ctx->initialized == 0) {
-    for (int i = 0 ; i < 8 ; i++) {
-      ctx->lfsr_a[i] = ctx->lfsr_a[i] ^ ctx->z[i];
-      update_lfsr(ctx);
+#else
+static void xor_blocks(struct snow_vi_ctx *ctx, const uint8_t *in, uint8_t *out,
+		       size_t n, int stream) {
+  uint8_t z[16];
+
+  (void) stream;
+  for (size_t i = 0 ; i < n ; i++) {
+    gen_z(ctx, z);
+    for (int j = 0 ; j < 16 ; j++) {
+      out[16 * i + j] = in[16 * i + j] ^ z[j];
     }
+    clock_state(ctx);
   }
 }
+#endif
+
+
+// XOR the next len bytes of keystream into in and write the result to
+// out. Partial blocks are handled as in snow_vi_keystream().
+void snow_vi_xor(struct snow_vi_ctx *ctx, const uint8_t *in, uint8_t *out, size_t len) {
+  uint8_t z[16];
+  size_t n;
+
+  if (ctx->ks_pos != 0) {
+    n = 16 - ctx->ks_pos;
+    if (n > len) {
+      n = len;
+    }
+
+    gen_z(ctx, z);
+    for (size_t i = 0 ; i < n ; i++) {
+      out[i] = in[i] ^ z[ctx->ks_pos + i];
+    }
+    in += n;
+    out += n;
+    len -= n;
+    ctx->ks_pos = (uint8_t) ((ctx->ks_pos + n) & 15);
+
+    if (ctx->ks_pos != 0) {
+      return;
+    }
+    clock_state(ctx);
+  }
+
+  n = len / 16;
+  xor_blocks(ctx, in, out, n, (len >= SNOW_VI_XOR_NT_THRESHOLD) &&
+	     (((uintptr_t) out & 15) == 0));
+  in += 16 * n;
+  out += 16 * n;
+  len -= 16 * n;
+
+  if (len != 0) {
+    gen_z(ctx, z);
+    for (size_t i = 0 ; i < len ; i++) {
+      out[i] = in[i] ^ z[i];
+    }
+    ctx->ks_pos = (uint8_t) len;
+  }
+}
+
+
+// XOR the keystream into each fragment in turn. snow_vi_xor() carries
+// a partial block across fragment boundaries in ks_pos, and runs the
+// full blocks of large fragments through the bulk loop.
+void snow_vi_xor_iov(struct snow_vi_ctx *ctx, const struct snow_vi_iovec *iov,
+		     size_t iovcnt) {
+  for (size_t i = 0 ; i < iovcnt ; i++) {
+    snow_vi_xor(ctx, iov[i].base, iov[i].base, iov[i].len);
+  }
+}
+
+
+// Write the next 16 bytes of keystream to z.
+void snow_vi_next(struct snow_vi_ctx *ctx, uint8_t *z) {
+  snow_vi_keystream(ctx, z, 16);
+}
+
+
+void snow_vi_get_z(const struct snow_vi_ctx *ctx, uint8_t *z) {
+  gen_z(ctx, z);
+}
+
+
+static const uint8_t state_magic[4] = {'S', 'N', 'V', 'i'};
+
+
+// The LFSR words are written in logical order, so that a state saved
+// with the ring buffer layout can be restored with the shifted layout
+// and the other way around.
+void snow_vi_serialize(const struct snow_vi_ctx *ctx, uint8_t *out) {
+  memcpy(&out[0], state_magic, 4);
+  out[4] = SNOW_VI_STATE_VERSION;
+  out[5] = ctx->ks_pos;
+  out[6] = 0;
+  out[7] = 0;
+
+  for (int i = 0 ; i < 16 ; i++) {
+    out[8 + 2 * i] = (uint8_t) LFSR_A(ctx, i);
+    out[9 + 2 * i] = (uint8_t) (LFSR_A(ctx, i) >> 8);
+    out[40 + 2 * i] = (uint8_t) LFSR_B(ctx, i);
+    out[41 + 2 * i] = (uint8_t) (LFSR_B(ctx, i) >> 8);
+  }
+
+  for (int i = 0 ; i < 4 ; i++) {
+    for (int j = 0 ; j < 4 ; j++) {
+      out[72 + 4 * i + j] = (uint8_t) (ctx->r1[i] >> (8 * j));
+      out[88 + 4 * i + j] = (uint8_t) (ctx->r2[i] >> (8 * j));
+      out[104 + 4 * i + j] = (uint8_t) (ctx->r3[i] >> (8 * j));
+    }
+  }
+}
+
+
+static uint32_t load_le32(const uint8_t *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) |
+    ((uint32_t) p[3] << 24);
+}
+
+
+int snow_vi_restore(struct snow_vi_ctx *ctx, const uint8_t *in) {
+  if ((memcmp(&in[0], state_magic, 4) != 0) || (in[4] != SNOW_VI_STATE_VERSION) ||
+      (in[5] > 15) || (in[6] != 0) || (in[7] != 0)) {
+    return -1;
+  }
+
+#if defined(SNOW_VI_LFSR_RING)
+  ctx->lfsr_head = 0;
+#endif
+  ctx->ks_pos = in[5];
+
+  for (int i = 0 ; i < 16 ; i++) {
+    ctx->lfsr_a[i] = u8_u16(in[8 + 2 * i], in[9 + 2 * i]);
+    ctx->lfsr_b[i] = u8_u16(in[40 + 2 * i], in[41 + 2 * i]);
+  }
+
+  for (int i = 0 ; i < 4 ; i++) {
+    ctx->r1[i] = load_le32(&in[72 + 4 * i]);
+    ctx->r2[i] = load_le32(&in[88 + 4 * i]);
+    ctx->r3[i] = load_le32(&in[104 + 4 * i]);
+  }
+
+  return 0;
+}
 
 
 // Display the current state.
-void snow_vi_display_state(struct snow_vi_ctx *ctx) {
+void snow_vi_display_state(const struct snow_vi_ctx *ctx) {
+  const uint16_t *t1 = tap_t1(ctx);
+  const uint16_t *t2 = tap_t2(ctx);
+  uint8_t z[16];
+
   printf("Current state:\n");
   printf("--------------\n");
-  printf("initalized: %1d\n", ctx->initialized);
   printf("lfsr_a: ");
 
   for (int i = 0 ; i < 16 ; i++) {
-    printf("0x%04x ", ctx->lfsr_a[i]);
+    printf("0x%04x ", LFSR_A(ctx, i));
   }
   printf("\n");
 
   printf("lfsr_b: ");
   for (int i = 0 ; i < 16 ; i++) {
-    printf("0x%04x ", ctx->lfsr_b[i]);
+    printf("0x%04x ", LFSR_B(ctx, i));
   }
   printf("\n");
 
@@ -184,16 +678,18 @@ void snow_vi_display_state(struct snow_vi_ctx *ctx) {
 	 ctx->r3[0], ctx->r3[1], ctx->r3[2], ctx->r3[3]);
   printf("\n");
 
-  printf("t1:     0x%04x 0x%04x 0x%04x 0x%04x\n",
-	 ctx->t1[0], ctx->t1[1], ctx->t1[2], ctx->t1[3]);
-  printf("t2:     0x%04x 0x%04x 0x%04x 0x%04x\n",
-	 ctx->t2[0], ctx->t2[1], ctx->t2[2], ctx->t2[3]);
+  printf("t1:     0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x\n",
+	 t1[0], t1[1], t1[2], t1[3], t1[4], t1[5], t1[6], t1[7]);
+  printf("t2:     0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x\n",
+	 t2[0], t2[1], t2[2], t2[3], t2[4], t2[5], t2[6], t2[7]);
   printf("\n");
 
-  printf("z:      0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x 0x%04x\n",
-	 ctx->z[0], ctx->z[1], ctx->z[2], ctx->z[3],
-	 ctx->z[4], ctx->z[5], ctx->z[6], ctx->z[7]);
-  printf("\n");
+  gen_z(ctx, z);
+  printf("z:      ");
+  for (int i = 0 ; i < 16 ; i++) {
+    printf("%02x ", z[i]);
+  }
+  printf("\n\n");
 }
 
 //=======================================================================
@@ -37,33 +37,141 @@
 //
 //=======================================================================
 
+#ifndef snow_vi_h
+#define snow_vi_h
+
+#include <stddef.h>
 #include <stdint.h>
 
+// The context only holds the live cipher state, 64 bytes of LFSR and 48
+// bytes of FSM registers, packed and aligned to a cache line. The taps
+// t1 and t2 are read in place from the LFSRs and the keystream z is
+// only computed when produced. Contexts allocated on the heap must use
+// an allocator honouring the alignment, for example aligned_alloc().
+//
+// With -DSNOW_VI_LFSR_RING the LFSRs are stored as ring buffers where
+// word i is at index (lfsr_head + i) & 15. Clocking then writes the new
+// word over the oldest and advances the head, instead of shifting all
+// words. This suits scalar and embedded targets. The default layout
+// keeps word i at index i, which suits the SIMD update.
 struct snow_vi_ctx {
-  uint16_t lfsr_a[16];
+  _Alignas(64) uint16_t lfsr_a[16];
   uint16_t lfsr_b[16];
 
-  uint16_t r1[8];
-  uint16_t r2[8];
-  uint16_t r3[8];
+  // The FSM registers are 128 bit values handled as four 32-bit words.
+  // Their byte order is the little endian byte order of the words, as
+  // used by the AES round.
+  uint32_t r1[4];
+  uint32_t r2[4];
+  uint32_t r3[4];
+
+#if defined(SNOW_VI_LFSR_RING)
+  uint8_t lfsr_head;
+#endif
+
+  // Offset into the keystream block of the current state when it has
+  // been partially consumed, zero otherwise.
+  uint8_t ks_pos;
+};
 
-  uint16_t t1[8];
-  uint16_t t2[8];
+_Static_assert(sizeof(struct snow_vi_ctx) == 128,
+	       "snow_vi_ctx should fill two cache lines");
 
-  uint16_t z[8];
+// snow_vi_xor() writes the full blocks of calls of at least this many
+// bytes with non-temporal stores, if the output is 16 byte aligned.
+// This keeps bulk encryption from evicting the rest of the working set
+// from the caches.
+#ifndef SNOW_VI_XOR_NT_THRESHOLD
+#define SNOW_VI_XOR_NT_THRESHOLD (1024 * 1024)
+#endif
 
-  uint8_t initialized;
+// A buffer fragment, with the same members as the POSIX struct iovec.
+struct snow_vi_iovec {
+  uint8_t *base;
+  size_t len;
 };
 
 // Initalize the given context based on the given key  and iv.
 void snow_vi_init(struct snow_vi_ctx*, const uint8_t *key, const uint8_t *iv);
 
-// Update to the next state.
-void snow_vi_next(struct snow_vi_ctx *ctx);
+// Initialize the context for the AEAD mode, where the lower half of
+// lfsr_b is loaded with a constant instead of zeros. See
+// snow_vi_aead.h.
+void snow_vi_init_aead(struct snow_vi_ctx *ctx, const uint8_t *key, const uint8_t *iv);
+
+// Derive the iv number seq of a sequence: iv_base with seq, as a big
+// endian 64-bit value, added with XOR to its last eight bytes. Used
+// for the packets of a pool and the chunks of a file.
+//
+// The last eight bytes of iv_base are reserved for seq and must be
+// zero. Otherwise base B with seq i gives the iv of base B ^ i with
+// seq 0, and two different bases can still produce the same ivs. With
+// the reserved bytes zero, ivs of different bases never collide.
+void snow_vi_derive_iv(const uint8_t *iv_base, uint64_t seq, uint8_t *iv);
+
+// Returns 0 if the last eight bytes of iv_base are zero, as required
+// by snow_vi_derive_iv(), and -1 otherwise.
+int snow_vi_check_iv_base(const uint8_t *iv_base);
+
+// Zero len bytes at buf, for keys and states. Unlike a plain memset()
+// the stores are kept even if buf is freed or never read again.
+void snow_vi_wipe(void *buf, size_t len);
+
+// Write the next len bytes of keystream to out. Calls may use any
+// length, the keystream continues where the previous call stopped.
+void snow_vi_keystream(struct snow_vi_ctx *ctx, uint8_t *out, size_t len);
+
+// XOR the next len bytes of keystream into in and write the result to
+// out, i.e. encrypt or decrypt. in and out may be the same buffer.
+void snow_vi_xor(struct snow_vi_ctx *ctx, const uint8_t *in, uint8_t *out, size_t len);
+
+// XOR the keystream in place into a chain of iovcnt fragments, as if
+// they were one contiguous buffer. Fragments may have any length and
+// alignment.
+void snow_vi_xor_iov(struct snow_vi_ctx *ctx, const struct snow_vi_iovec *iov,
+		     size_t iovcnt);
+
+// Write the next 16 bytes of keystream to z.
+//
+// This replaces the former snow_vi_next(ctx), which clocked the state
+// and left the new block in ctx->z. The context no longer holds z, so
+// code reading ctx->z must call snow_vi_next() or snow_vi_get_z().
+void snow_vi_next(struct snow_vi_ctx *ctx, uint8_t *z);
+
+// Write the keystream block of the current state to z without
+// clocking, the value the former ctx->z held. If the block has been
+// partially consumed, ctx->ks_pos of its bytes are already used.
+void snow_vi_get_z(const struct snow_vi_ctx *ctx, uint8_t *z);
+
+// The serialized state of a context is SNOW_VI_STATE_SIZE bytes, in
+// a layout that does not depend on the host or the build options:
+//
+//   0  4 bytes  magic "SNVi"
+//   4  1 byte   format version
+//   5  1 byte   ks_pos, the offset into a partially consumed block
+//   6  2 bytes  reserved, zero
+//   8 32 bytes  lfsr_a, words 0 to 15 as little endian 16-bit values
+//  40 32 bytes  lfsr_b, in the same way
+//  72 48 bytes  r1, r2 and r3, as little endian 32-bit words
+//
+// The state contains the key stream position and must be protected
+// like a key.
+#define SNOW_VI_STATE_VERSION 1
+#define SNOW_VI_STATE_SIZE 120
+
+// Write the state of the context to out. The keystream after
+// snow_vi_restore() continues where it stopped in ctx.
+void snow_vi_serialize(const struct snow_vi_ctx *ctx, uint8_t *out);
+
+// Restore a context from a serialized state. Returns 0 on success and
+// -1 if the magic, version or reserved bytes are wrong or the offset
+// is out of range, in which case ctx is not changed.
+int snow_vi_restore(struct snow_vi_ctx *ctx, const uint8_t *in);
 
 // Display the current state.
-void snow_vi_display_state(struct snow_vi_ctx *ctx);
+void snow_vi_display_state(const struct snow_vi_ctx *ctx);
 
+#endif // snow_vi_h
 
 //=======================================================================
 // EOF snow_vi.h
@@ -0,0 +1,449 @@
+//=======================================================================
+// snow_vi_aead.c
+// --------------
+// The AEAD mode of SNOW-Vi. The bulk loop is stitched: the keystream
+// of each step of eight blocks is generated while GHASH processes the
+// previous step, so that the AES rounds of the FSM and the carry-less
+// multiplications of GHASH can execute in parallel.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_cpu.h"
+#include "snow_vi_aead.h"
+
+#if SNOW_VI_X86
+#include <immintrin.h>
+#endif
+
+// Blocks per GHASH reduction, and blocks per step of the stitched
+// loop.
+#define GROUP 4
+#define STITCH (2 * GROUP)
+
+
+// GHASH state. The generic code keeps H and the accumulator x as big
+// endian 64-bit halves. The PCLMULQDQ code keeps the powers H^1 to
+// H^GROUP and the accumulator byte reversed in SIMD registers.
+struct ghash {
+  int pclmul;
+  uint64_t h[2];
+  uint64_t x[2];
+#if SNOW_VI_X86
+  __m128i hp[GROUP];
+  __m128i xr;
+#endif
+};
+
+
+static uint64_t load_be64(const uint8_t *p) {
+  uint64_t x = 0;
+
+  for (int i = 0 ; i < 8 ; i++) {
+    x = (x << 8) | p[i];
+  }
+  return x;
+}
+
+
+static void store_be64(uint8_t *p, uint64_t x) {
+  for (int i = 0 ; i < 8 ; i++) {
+    p[i] = (uint8_t) (x >> (56 - 8 * i));
+  }
+}
+
+
+//------------------------------------------------------------------
+// Generic GHASH, the bitwise multiplication of the GCM specification.
+//------------------------------------------------------------------
+static void gf_mul_generic(uint64_t *x, const uint64_t *h) {
+  uint64_t z[2] = {0, 0};
+  uint64_t v[2] = {h[0], h[1]};
+
+  for (int i = 0 ; i < 128 ; i++) {
+    uint64_t bit = (x[i / 64] >> (63 - (i % 64))) & 1;
+    uint64_t lsb = v[1] & 1;
+
+    z[0] ^= v[0] & (0 - bit);
+    z[1] ^= v[1] & (0 - bit);
+
+    v[1] = (v[1] >> 1) | (v[0] << 63);
+    v[0] = (v[0] >> 1) ^ (0xe100000000000000ULL & (0 - lsb));
+  }
+
+  x[0] = z[0];
+  x[1] = z[1];
+}
+
+
+static void ghash_blocks_generic(struct ghash *g, const uint8_t *in, size_t n) {
+  for (size_t i = 0 ; i < n ; i++) {
+    g->x[0] ^= load_be64(&in[16 * i]);
+    g->x[1] ^= load_be64(&in[16 * i + 8]);
+    gf_mul_generic(g->x, g->h);
+  }
+}
+
+
+//------------------------------------------------------------------
+// GHASH with PCLMULQDQ. The blocks are byte reversed, and the
+// products computed as in the Intel carry-less multiplication white
+// paper: a 256-bit product, shifted left by one bit for the reflected
+// bit order, and reduced modulo x^128 + x^7 + x^2 + x + 1. Products
+// of GROUP blocks with the powers of H are summed before a single
+// reduction.
+//------------------------------------------------------------------
+#if SNOW_VI_X86
+__attribute__((target("ssse3")))
+static inline __m128i bswap128(__m128i a) {
+  const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				    8, 9, 10, 11, 12, 13, 14, 15);
+  return _mm_shuffle_epi8(a, mask);
+}
+
+
+// Add the unreduced product of a and b to lo, mid and hi.
+__attribute__((target("pclmul,ssse3")))
+static inline void clmul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *mid,
+			     __m128i *hi) {
+  *lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+  *hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+  *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+  *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i clmul_reduce(__m128i lo, __m128i mid, __m128i hi) {
+  __m128i t7, t8, t9, t2, t4, t5;
+
+  lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+  // Shift the product hi:lo left by one bit.
+  t7 = _mm_srli_epi32(lo, 31);
+  t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(hi, t8);
+  hi = _mm_or_si128(hi, t9);
+
+  // Reduce.
+  t7 = _mm_slli_epi32(lo, 31);
+  t8 = _mm_slli_epi32(lo, 30);
+  t9 = _mm_slli_epi32(lo, 25);
+  t7 = _mm_xor_si128(t7, _mm_xor_si128(t8, t9));
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  lo = _mm_xor_si128(lo, t7);
+
+  t2 = _mm_srli_epi32(lo, 1);
+  t4 = _mm_srli_epi32(lo, 2);
+  t5 = _mm_srli_epi32(lo, 7);
+  t2 = _mm_xor_si128(t2, _mm_xor_si128(t4, t5));
+  t2 = _mm_xor_si128(t2, t8);
+  lo = _mm_xor_si128(lo, t2);
+
+  return _mm_xor_si128(hi, lo);
+}
+
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i clmul(__m128i a, __m128i b) {
+  __m128i lo = _mm_setzero_si128();
+  __m128i mid = _mm_setzero_si128();
+  __m128i hi = _mm_setzero_si128();
+
+  clmul_acc(a, b, &lo, &mid, &hi);
+  return clmul_reduce(lo, mid, hi);
+}
+
+
+__attribute__((target("pclmul,ssse3")))
+static void ghash_init_pclmul(struct ghash *g, const uint8_t *h) {
+  g->hp[0] = bswap128(_mm_loadu_si128((const __m128i *) h));
+  for (int i = 1 ; i < GROUP ; i++) {
+    g->hp[i] = clmul(g->hp[i - 1], g->hp[0]);
+  }
+  g->xr = _mm_setzero_si128();
+}
+
+
+__attribute__((target("pclmul,ssse3")))
+static void ghash_blocks_pclmul(struct ghash *g, const uint8_t *in, size_t n) {
+  __m128i x = g->xr;
+  size_t i = 0;
+
+  // x = (x + b0) * H^4 + b1 * H^3 + b2 * H^2 + b3 * H
+  for ( ; i + GROUP <= n ; i += GROUP) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    for (int j = 0 ; j < GROUP ; j++) {
+      __m128i b = bswap128(_mm_loadu_si128((const __m128i *) &in[16 * (i + j)]));
+
+      if (j == 0) {
+	b = _mm_xor_si128(b, x);
+      }
+      clmul_acc(b, g->hp[GROUP - 1 - j], &lo, &mid, &hi);
+    }
+    x = clmul_reduce(lo, mid, hi);
+  }
+
+  for ( ; i < n ; i++) {
+    __m128i b = bswap128(_mm_loadu_si128((const __m128i *) &in[16 * i]));
+    x = clmul(_mm_xor_si128(x, b), g->hp[0]);
+  }
+
+  g->xr = x;
+}
+
+
+__attribute__((target("ssse3")))
+static void ghash_result_pclmul(const struct ghash *g, uint8_t *out) {
+  _mm_storeu_si128((__m128i *) out, bswap128(g->xr));
+}
+
+#else
+static void ghash_init_pclmul(struct ghash *g, const uint8_t *h) {
+  (void) g;
+  (void) h;
+}
+
+static void ghash_blocks_pclmul(struct ghash *g, const uint8_t *in, size_t n) {
+  ghash_blocks_generic(g, in, n);
+}
+
+static void ghash_result_pclmul(const struct ghash *g, uint8_t *out) {
+  (void) g;
+  (void) out;
+}
+#endif
+
+
+//------------------------------------------------------------------
+// GHASH over the backends.
+//------------------------------------------------------------------
+static void ghash_init(struct ghash *g, const uint8_t *h, int pclmul) {
+  g->pclmul = pclmul;
+  g->h[0] = load_be64(&h[0]);
+  g->h[1] = load_be64(&h[8]);
+  g->x[0] = 0;
+  g->x[1] = 0;
+
+  if (pclmul) {
+    ghash_init_pclmul(g, h);
+  }
+}
+
+
+static void ghash_blocks(struct ghash *g, const uint8_t *in, size_t n) {
+  if (g->pclmul) {
+    ghash_blocks_pclmul(g, in, n);
+  }
+  else {
+    ghash_blocks_generic(g, in, n);
+  }
+}
+
+
+// Hash len bytes, with a partial last block padded with zeros.
+static void ghash_update(struct ghash *g, const uint8_t *in, size_t len) {
+  uint8_t block[16] = {0};
+
+  ghash_blocks(g, in, len / 16);
+  if ((len % 16) != 0) {
+    memcpy(block, &in[len - len % 16], len % 16);
+    ghash_blocks(g, block, 1);
+  }
+}
+
+
+// Hash the length block and write the result.
+static void ghash_final(struct ghash *g, size_t aad_len, size_t c_len, uint8_t *out) {
+  uint8_t block[16];
+
+  store_be64(&block[0], (uint64_t) aad_len * 8);
+  store_be64(&block[8], (uint64_t) c_len * 8);
+  ghash_blocks(g, block, 1);
+
+  if (g->pclmul) {
+    ghash_result_pclmul(g, out);
+  }
+  else {
+    store_be64(&out[0], g->x[0]);
+    store_be64(&out[8], g->x[1]);
+  }
+}
+
+
+static void ghash(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+		  const uint8_t *c, size_t c_len, uint8_t *out, int pclmul) {
+  struct ghash g;
+
+  ghash_init(&g, h, pclmul);
+  ghash_update(&g, aad, aad_len);
+  ghash_update(&g, c, c_len);
+  ghash_final(&g, aad_len, c_len, out);
+}
+
+
+void snow_vi_ghash(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+		   const uint8_t *c, size_t c_len, uint8_t *out) {
+  ghash(h, aad, aad_len, c, c_len, out, snow_vi_cpu_has_pclmul());
+}
+
+
+void snow_vi_ghash_generic(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+			   const uint8_t *c, size_t c_len, uint8_t *out) {
+  ghash(h, aad, aad_len, c, c_len, out, 0);
+}
+
+
+void snow_vi_ghash_pclmul(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+			  const uint8_t *c, size_t c_len, uint8_t *out) {
+  ghash(h, aad, aad_len, c, c_len, out, 1);
+}
+
+
+//------------------------------------------------------------------
+// AEAD.
+//------------------------------------------------------------------
+
+// Initialize the context and GHASH, and hash the associated data. The
+// tag mask is written to mask.
+static void aead_start(struct snow_vi_ctx *ctx, struct ghash *g, const uint8_t *key,
+		       const uint8_t *iv, const uint8_t *aad, size_t aad_len,
+		       uint8_t *mask) {
+  uint8_t h[16];
+
+  snow_vi_init_aead(ctx, key, iv);
+  snow_vi_keystream(ctx, h, 16);
+  snow_vi_keystream(ctx, mask, 16);
+
+  ghash_init(g, h, snow_vi_cpu_has_pclmul());
+  ghash_update(g, aad, aad_len);
+  memset(h, 0, sizeof(h));
+}
+
+
+// Hash the length block and XOR the mask into the tag.
+static void aead_finish(struct ghash *g, size_t aad_len, size_t len,
+			const uint8_t *mask, uint8_t *tag) {
+  ghash_final(g, aad_len, len, tag);
+  for (int i = 0 ; i < 16 ; i++) {
+    tag[i] ^= mask[i];
+  }
+}
+
+
+void snow_vi_aead_encrypt(const uint8_t *key, const uint8_t *iv,
+			  const uint8_t *aad, size_t aad_len,
+			  const uint8_t *in, uint8_t *out, size_t len,
+			  uint8_t *tag) {
+  struct snow_vi_ctx ctx;
+  struct ghash g;
+  uint8_t mask[16];
+  size_t steps = len / (16 * STITCH);
+  size_t done = 16 * STITCH * steps;
+
+  aead_start(&ctx, &g, key, iv, aad, aad_len, mask);
+
+  // GHASH needs the ciphertext, so it runs one step behind the
+  // encryption.
+  for (size_t i = 0 ; i < steps ; i++) {
+    snow_vi_xor(&ctx, &in[16 * STITCH * i], &out[16 * STITCH * i], 16 * STITCH);
+    if (i > 0) {
+      ghash_blocks(&g, &out[16 * STITCH * (i - 1)], STITCH);
+    }
+  }
+  if (steps > 0) {
+    ghash_blocks(&g, &out[done - 16 * STITCH], STITCH);
+  }
+
+  snow_vi_xor(&ctx, &in[done], &out[done], len - done);
+  ghash_update(&g, &out[done], len - done);
+
+  aead_finish(&g, aad_len, len, mask, tag);
+  memset(&ctx, 0, sizeof(ctx));
+  memset(&g, 0, sizeof(g));
+}
+
+
+int snow_vi_aead_decrypt(const uint8_t *key, const uint8_t *iv,
+			 const uint8_t *aad, size_t aad_len,
+			 const uint8_t *in, uint8_t *out, size_t len,
+			 const uint8_t *tag) {
+  struct snow_vi_ctx ctx;
+  struct ghash g;
+  uint8_t mask[16];
+  uint8_t res[16];
+  uint8_t diff = 0;
+  size_t steps = len / (16 * STITCH);
+  size_t done = 16 * STITCH * steps;
+
+  aead_start(&ctx, &g, key, iv, aad, aad_len, mask);
+
+  // The ciphertext is hashed before it is decrypted, as out may be in.
+  for (size_t i = 0 ; i < steps ; i++) {
+    ghash_blocks(&g, &in[16 * STITCH * i], STITCH);
+    snow_vi_xor(&ctx, &in[16 * STITCH * i], &out[16 * STITCH * i], 16 * STITCH);
+  }
+
+  ghash_update(&g, &in[done], len - done);
+  snow_vi_xor(&ctx, &in[done], &out[done], len - done);
+
+  aead_finish(&g, aad_len, len, mask, res);
+  memset(&ctx, 0, sizeof(ctx));
+  memset(&g, 0, sizeof(g));
+
+  // Compare in constant time.
+  for (int i = 0 ; i < 16 ; i++) {
+    diff |= (uint8_t) (res[i] ^ tag[i]);
+  }
+
+  if (diff != 0) {
+    memset(out, 0, len);
+    return -1;
+  }
+  return 0;
+}
+
+//=======================================================================
+// EOF snow_vi_aead.c
+//=======================================================================
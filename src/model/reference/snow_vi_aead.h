@@ -0,0 +1,83 @@
+//=======================================================================
+// snow_vi_aead.h
+// --------------
+// The AEAD mode of SNOW-Vi, the GCM style mode defined for SNOW-V.
+//
+// The context is initialized with snow_vi_init_aead(). The first
+// keystream block is the GHASH key H and the second the mask for the
+// tag. Encryption uses the keystream from the third block on, and the
+// tag is GHASH of the associated data and ciphertext, as in GCM, XOR
+// the mask.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_aead_h
+#define snow_vi_aead_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNOW_VI_AEAD_TAG_SIZE 16
+
+// Encrypt len bytes from in to out and write the tag for the
+// associated data aad and the ciphertext to tag. in and out may be
+// the same buffer.
+void snow_vi_aead_encrypt(const uint8_t *key, const uint8_t *iv,
+			  const uint8_t *aad, size_t aad_len,
+			  const uint8_t *in, uint8_t *out, size_t len,
+			  uint8_t *tag);
+
+// Decrypt len bytes from in to out and check the tag. Returns 0 if the
+// tag is valid. Otherwise out is cleared and -1 returned. in and out
+// may be the same buffer.
+int snow_vi_aead_decrypt(const uint8_t *key, const uint8_t *iv,
+			 const uint8_t *aad, size_t aad_len,
+			 const uint8_t *in, uint8_t *out, size_t len,
+			 const uint8_t *tag);
+
+// GHASH with key h of the associated data and ciphertext, including
+// the final length block, as defined for GCM. The _generic version is
+// portable, the _pclmul version uses carry-less multiplication with
+// the reduction aggregated over four blocks and may only be called if
+// snow_vi_cpu_has_pclmul(). snow_vi_ghash() selects one at run time.
+void snow_vi_ghash(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+		   const uint8_t *c, size_t c_len, uint8_t *out);
+void snow_vi_ghash_generic(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+			   const uint8_t *c, size_t c_len, uint8_t *out);
+void snow_vi_ghash_pclmul(const uint8_t *h, const uint8_t *aad, size_t aad_len,
+			  const uint8_t *c, size_t c_len, uint8_t *out);
+
+#endif // snow_vi_aead_h
+
+//=======================================================================
+// EOF snow_vi_aead.h
+//=======================================================================
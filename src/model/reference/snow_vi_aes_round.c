@@ -34,7 +34,10 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //=======================================================================
 
+#include <stdatomic.h>
 #include <stdint.h>
+#include <string.h>
+#include "snow_vi_cpu.h"
 #include "snow_vi_aes_round.h"
 
  uint8_t aes_sbox[256] = {
@@ -135,7 +138,7 @@ void shift_rows(uint8_t *aes_state) {
 }
 
 
-void aes_round(uint8_t *block_in, uint8_t *block_out) {
+void aes_round_ref(const uint8_t *block_in, uint8_t *block_out) {
     uint8_t aes_state[16];
 
     // Copy block_in into AES 2D state array
@@ -159,6 +162,96 @@ void aes_round(uint8_t *block_in, uint8_t *block_out) {
 }
 
 
+void aes_round_ref_x2(const uint8_t *in0, uint8_t *out0,
+		      const uint8_t *in1, uint8_t *out1) {
+  uint8_t tmp[16];
+
+  aes_round_ref(in0, tmp);
+  aes_round_ref(in1, out1);
+  memcpy(out0, tmp, 16);
+}
+
+
+void aes_round_ref_n(const uint8_t *block_in, uint8_t *block_out, int n) {
+  for (int i = 0 ; i < n ; i++) {
+    aes_round_ref(&block_in[16 * i], &block_out[16 * i]);
+  }
+}
+
+
+// The set of functions provided by a backend.
+struct aes_round_backend {
+  void (*round)(const uint8_t *, uint8_t *);
+  void (*round_x2)(const uint8_t *, uint8_t *, const uint8_t *, uint8_t *);
+  void (*round_n)(const uint8_t *, uint8_t *, int);
+};
+
+static const struct aes_round_backend backend_ni =
+  {aes_round_ni, aes_round_ni_x2, aes_round_ni_n};
+
+#if defined(SNOW_VI_AES_TABLE)
+static const struct aes_round_backend backend_table =
+  {aes_round_table, aes_round_table_x2, aes_round_table_n};
+#else
+static const struct aes_round_backend backend_vperm =
+  {aes_round_vperm, aes_round_vperm_x2, aes_round_vperm_n};
+
+static const struct aes_round_backend backend_ref =
+  {aes_round_ref, aes_round_ref_x2, aes_round_ref_n};
+#endif
+
+
+// Use AES-NI if the CPU has it, otherwise the vector permute backend
+// or a portable backend.
+static const struct aes_round_backend *aes_round_select(void) {
+  if (snow_vi_cpu_has_aesni()) {
+    return &backend_ni;
+  }
+
+#if defined(SNOW_VI_AES_TABLE)
+  return &backend_table;
+#else
+  if (snow_vi_cpu_has_ssse3()) {
+    return &backend_vperm;
+  }
+
+  return &backend_ref;
+#endif
+}
+
+
+// The backend in use, selected on the first call so that the CPU is
+// not queried for every round.
+static const struct aes_round_backend *_Atomic aes_round_current;
+
+static const struct aes_round_backend *aes_round_backend(void) {
+  const struct aes_round_backend *backend =
+    atomic_load_explicit(&aes_round_current, memory_order_relaxed);
+
+  if (backend == NULL) {
+    backend = aes_round_select();
+    atomic_store_explicit(&aes_round_current, backend, memory_order_relaxed);
+  }
+  return backend;
+}
+
+
+void aes_round(const uint8_t *block_in, uint8_t *block_out) {
+  aes_round_backend()->round(block_in, block_out);
+}
+
+
+void aes_round_x2(const uint8_t *in0, uint8_t *out0,
+		  const uint8_t *in1, uint8_t *out1) {
+  aes_round_backend()->round_x2(in0, out0, in1, out1);
+}
+
+
+void aes_round_n(const uint8_t *block_in, uint8_t *block_out, int n) {
+  aes_round_backend()->round_n(block_in, block_out, n);
+}
+
+
 //=======================================================================
 // EOF snow_vi_aes_round.c
 //=======================================================================
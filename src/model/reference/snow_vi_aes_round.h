@@ -34,9 +34,79 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //=======================================================================
 
+#ifndef snow_vi_aes_round_h
+#define snow_vi_aes_round_h
+
 #include <stdint.h>
 
-void aes_round(uint8_t *block_in, uint8_t *block_out);
+// Perform one keyless AES round (SubBytes, ShiftRows, MixColumns) on
+// block_in and store the result in block_out. AES-NI is used if the
+// CPU supports it. Otherwise the constant time vector permute backend is
+// used if the CPU supports SSSE3, and the reference implementation if
+// not. Building with -DSNOW_VI_AES_TABLE replaces the last two with the
+// table based implementation.
+void aes_round(const uint8_t *block_in, uint8_t *block_out);
+
+// Perform the round on two independent blocks in one call, allowing
+// the backend to issue both rounds together. The outputs may alias any
+// of the inputs. Used by the FSM update for the r1 and r2 rounds.
+void aes_round_x2(const uint8_t *in0, uint8_t *out0,
+		  const uint8_t *in1, uint8_t *out1);
+
+// Perform the round on n consecutive 16 byte blocks.
+void aes_round_n(const uint8_t *block_in, uint8_t *block_out, int n);
+
+// Byte oriented reference implementation.
+void aes_round_ref(const uint8_t *block_in, uint8_t *block_out);
+void aes_round_ref_x2(const uint8_t *in0, uint8_t *out0,
+		      const uint8_t *in1, uint8_t *out1);
+void aes_round_ref_n(const uint8_t *block_in, uint8_t *block_out, int n);
+
+// Table based implementation. Faster than the reference implementation
+// but not constant time.
+void aes_round_table(const uint8_t *block_in, uint8_t *block_out);
+void aes_round_table_x2(const uint8_t *in0, uint8_t *out0,
+			const uint8_t *in1, uint8_t *out1);
+void aes_round_table_n(const uint8_t *block_in, uint8_t *block_out, int n);
+
+// Vector permute implementation. Constant time. Must only be called if
+// snow_vi_cpu_has_ssse3() returns non-zero.
+void aes_round_vperm(const uint8_t *block_in, uint8_t *block_out);
+void aes_round_vperm_x2(const uint8_t *in0, uint8_t *out0,
+			const uint8_t *in1, uint8_t *out1);
+void aes_round_vperm_n(const uint8_t *block_in, uint8_t *block_out, int n);
+
+// Bitsliced implementation processing up to AES_BS_LANES blocks in
+// parallel. Constant time. Bit n of q[p][b] holds bit b of byte p in
+// block n. Use aes_bs_pack() to load n blocks into the bitsliced state,
+// aes_round_bs() to perform the round on all of them, and
+// aes_bs_unpack() to store the n blocks back. n must be at most
+// AES_BS_LANES, larger counts are clamped and only the first
+// AES_BS_LANES blocks are processed. To run the FSM rounds of
+// several SNOW-Vi contexts, pass pointers to their r1 and r2 registers.
+//
+// The lane count is fixed. aes_round_bs() always runs the circuit for
+// all AES_BS_LANES lanes, lanes not loaded by aes_bs_pack() are zero,
+// so a round costs the same for 1 block as for 32. Including the
+// packing, it is slower than aes_round_ref_n() below about 5 blocks.
+#define AES_BS_LANES 32
+
+struct aes_bs_state {
+  uint32_t q[16][8];
+};
+
+void aes_bs_pack(struct aes_bs_state *state, const uint8_t *const blocks[], int n);
+void aes_bs_unpack(const struct aes_bs_state *state, uint8_t *const blocks[], int n);
+void aes_round_bs(struct aes_bs_state *state);
+
+// AES-NI implementation. Must only be called if
+// snow_vi_cpu_has_aesni() returns non-zero.
+void aes_round_ni(const uint8_t *block_in, uint8_t *block_out);
+void aes_round_ni_x2(const uint8_t *in0, uint8_t *out0,
+		     const uint8_t *in1, uint8_t *out1);
+void aes_round_ni_n(const uint8_t *block_in, uint8_t *block_out, int n);
+
+#endif // snow_vi_aes_round_h
 
 
 //=======================================================================
@@ -0,0 +1,339 @@
+//=======================================================================
+// snow_vi_aes_round_bs.c
+// ----------------------
+// Bitsliced implementation of the simplified, keyless AES round
+// function that processes up to AES_BS_LANES independent blocks in one
+// pass. SubBytes uses the Boyar-Peralta S-box circuit, ShiftRows is a
+// renaming of the byte positions and MixColumns is done with word wide
+// XORs. The implementation is constant time.
+// 
+// The bitsliced state holds one word per byte position and bit, and bit
+// n of each word belongs to block n. aes_bs_pack() and aes_bs_unpack()
+// move blocks, for example the r1 and r2 registers of several SNOW-Vi
+// contexts, in and out of the bitsliced state.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#include <stdint.h>
+#include "snow_vi_aes_round.h"
+
+typedef uint32_t bs_word;
+
+
+// Transpose an 8x8 bit matrix with row i in byte i.
+static uint64_t transpose8(uint64_t x) {
+  uint64_t t;
+
+  t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+  x = x ^ t ^ (t << 28);
+
+  return x;
+}
+
+
+// Clamp a block count to the lanes of the bitsliced state.
+static int bs_lanes(int n) {
+  if (n < 0) {
+    return 0;
+  }
+  return (n > AES_BS_LANES) ? AES_BS_LANES : n;
+}
+
+
+void aes_bs_pack(struct aes_bs_state *state, const uint8_t *const blocks[], int n) {
+  n = bs_lanes(n);
+  for (int p = 0 ; p < 16 ; p++) {
+    for (int b = 0 ; b < 8 ; b++) {
+      state->q[p][b] = 0;
+    }
+
+    for (int g = 0 ; g < AES_BS_LANES ; g += 8) {
+      uint64_t x = 0;
+
+      for (int l = 0 ; l < 8 ; l++) {
+	if (g + l < n) {
+	  x |= (uint64_t) blocks[g + l][p] << (8 * l);
+	}
+      }
+
+      x = transpose8(x);
+      for (int b = 0 ; b < 8 ; b++) {
+	state->q[p][b] |= (bs_word) ((x >> (8 * b)) & 0xff) << g;
+      }
+    }
+  }
+}
+
+
+void aes_bs_unpack(const struct aes_bs_state *state, uint8_t *const blocks[], int n) {
+  n = bs_lanes(n);
+  for (int p = 0 ; p < 16 ; p++) {
+    for (int g = 0 ; g < n ; g += 8) {
+      uint64_t x = 0;
+
+      for (int b = 0 ; b < 8 ; b++) {
+	x |= (uint64_t) ((state->q[p][b] >> g) & 0xff) << (8 * b);
+      }
+
+      x = transpose8(x);
+      for (int l = 0 ; (l < 8) && (g + l < n) ; l++) {
+	blocks[g + l][p] = (uint8_t) (x >> (8 * l));
+      }
+    }
+  }
+}
+
+
+// Boyar-Peralta S-box circuit, 113 gates. q[0] is the least
+// significant bit.
+static void sbox_bs(bs_word *q) {
+  bs_word x0, x1, x2, x3, x4, x5, x6, x7;
+  bs_word y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  bs_word y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  bs_word y20, y21;
+  bs_word z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  bs_word z10, z11, z12, z13, z14, z15, z16, z17;
+  bs_word t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  bs_word t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  bs_word t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  bs_word t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  bs_word t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  bs_word t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  bs_word t60, t61, t62, t63, t64, t65, t66, t67;
+  bs_word s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  // Top linear transformation.
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // Non-linear section.
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // Bottom linear transformation.
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+
+// Multiply the bitsliced bytes in a by two.
+static void xtime_bs(const bs_word *a, bs_word *res) {
+  res[0] = a[7];
+  res[1] = a[0] ^ a[7];
+  res[2] = a[1];
+  res[3] = a[2] ^ a[7];
+  res[4] = a[3] ^ a[7];
+  res[5] = a[4];
+  res[6] = a[5];
+  res[7] = a[6];
+}
+
+
+void aes_round_bs(struct aes_bs_state *state) {
+  bs_word out[16][8];
+  bs_word tmp[8];
+  bs_word dbl[8];
+
+  for (int p = 0 ; p < 16 ; p++) {
+    sbox_bs(state->q[p]);
+  }
+
+  // ShiftRows moves row r of column c to column c - r. MixColumns is
+  // then 2 * (a[r] + a[r + 1]) + a[r + 1] + a[r + 2] + a[r + 3].
+  for (int c = 0 ; c < 4 ; c++) {
+    const bs_word *a[4];
+
+    for (int r = 0 ; r < 4 ; r++) {
+      a[r] = state->q[4 * ((c + r) & 0x03) + r];
+    }
+
+    for (int r = 0 ; r < 4 ; r++) {
+      const bs_word *a0 = a[r];
+      const bs_word *a1 = a[(r + 1) & 0x03];
+      const bs_word *a2 = a[(r + 2) & 0x03];
+      const bs_word *a3 = a[(r + 3) & 0x03];
+
+      for (int b = 0 ; b < 8 ; b++) {
+	tmp[b] = a0[b] ^ a1[b];
+      }
+
+      xtime_bs(tmp, dbl);
+      for (int b = 0 ; b < 8 ; b++) {
+	out[4 * c + r][b] = dbl[b] ^ a1[b] ^ a2[b] ^ a3[b];
+      }
+    }
+  }
+
+  for (int p = 0 ; p < 16 ; p++) {
+    for (int b = 0 ; b < 8 ; b++) {
+      state->q[p][b] = out[p][b];
+    }
+  }
+}
+
+
+//=======================================================================
+// EOF snow_vi_aes_round_bs.c
+//=======================================================================
@@ -0,0 +1,121 @@
+//=======================================================================
+// snow_vi_aes_round_ni.c
+// ----------------------
+// AES-NI implementation of the simplified, keyless AES round function.
+// With an all zero round key, aesenc performs exactly the round
+// used by the SNOW-Vi FSM.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#include <stdint.h>
+#include "snow_vi_cpu.h"
+#include "snow_vi_aes_round.h"
+
+#if SNOW_VI_X86
+#include <immintrin.h>
+
+__attribute__((target("aes")))
+void aes_round_ni(const uint8_t *block_in, uint8_t *block_out) {
+  __m128i state = _mm_loadu_si128((const __m128i *) block_in);
+
+  state = _mm_aesenc_si128(state, _mm_setzero_si128());
+  _mm_storeu_si128((__m128i *) block_out, state);
+}
+
+
+// Both blocks are loaded before any aesenc is issued, allowing the two
+// independent rounds to overlap in the AES unit.
+__attribute__((target("aes")))
+void aes_round_ni_x2(const uint8_t *in0, uint8_t *out0,
+		     const uint8_t *in1, uint8_t *out1) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i s0 = _mm_loadu_si128((const __m128i *) in0);
+  __m128i s1 = _mm_loadu_si128((const __m128i *) in1);
+
+  s0 = _mm_aesenc_si128(s0, zero);
+  s1 = _mm_aesenc_si128(s1, zero);
+  _mm_storeu_si128((__m128i *) out0, s0);
+  _mm_storeu_si128((__m128i *) out1, s1);
+}
+
+
+__attribute__((target("aes")))
+void aes_round_ni_n(const uint8_t *block_in, uint8_t *block_out, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i *in = (const __m128i *) block_in;
+  __m128i *out = (__m128i *) block_out;
+  int i = 0;
+
+  for ( ; i + 4 <= n ; i += 4) {
+    __m128i s0 = _mm_loadu_si128(&in[i]);
+    __m128i s1 = _mm_loadu_si128(&in[i + 1]);
+    __m128i s2 = _mm_loadu_si128(&in[i + 2]);
+    __m128i s3 = _mm_loadu_si128(&in[i + 3]);
+
+    s0 = _mm_aesenc_si128(s0, zero);
+    s1 = _mm_aesenc_si128(s1, zero);
+    s2 = _mm_aesenc_si128(s2, zero);
+    s3 = _mm_aesenc_si128(s3, zero);
+
+    _mm_storeu_si128(&out[i], s0);
+    _mm_storeu_si128(&out[i + 1], s1);
+    _mm_storeu_si128(&out[i + 2], s2);
+    _mm_storeu_si128(&out[i + 3], s3);
+  }
+
+  for ( ; i < n ; i++) {
+    _mm_storeu_si128(&out[i], _mm_aesenc_si128(_mm_loadu_si128(&in[i]), zero));
+  }
+}
+
+#else
+
+// Never selected on non-x86 targets.
+void aes_round_ni(const uint8_t *block_in, uint8_t *block_out) {
+  aes_round_ref(block_in, block_out);
+}
+
+void aes_round_ni_x2(const uint8_t *in0, uint8_t *out0,
+		     const uint8_t *in1, uint8_t *out1) {
+  aes_round_ref_x2(in0, out0, in1, out1);
+}
+
+void aes_round_ni_n(const uint8_t *block_in, uint8_t *block_out, int n) {
+  aes_round_ref_n(block_in, block_out, n);
+}
+
+#endif
+
+
+//=======================================================================
+// EOF snow_vi_aes_round_ni.c
+//=======================================================================
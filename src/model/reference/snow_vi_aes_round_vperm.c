@@ -0,0 +1,211 @@
+//=======================================================================
+// snow_vi_aes_round_vperm.c
+// -------------------------
+// Vector permute implementation of the simplified, keyless AES round
+// function, following the approach by Mike Hamburg in "Accelerating
+// AES with Vector Permute Instructions" (CHES 2009).
+// 
+// The state is moved to a tower field basis GF((2^4)^2), where the
+// inverse is computed with 4-bit table lookups using pshufb. All
+// lookups are register permutes, so there are no data dependent memory
+// accesses or branches and the round is constant time.
+// 
+// With x = i*t + k in GF(2^4)[t]/(t^2 + a*t + a), the values
+// io = 1/(1/i + a/k) + j and jo = 1/(1/j + a/k) + i, with j = i + k,
+// are such that 1/x is linear in 1/io and 1/jo. The inverses and the
+// linear output maps to the AES basis are merged into the output tables.
+// The affine constant 0x63 is added after MixColumns.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#include <stdint.h>
+#include "snow_vi_cpu.h"
+#include "snow_vi_aes_round.h"
+
+#if SNOW_VI_X86
+#include <immintrin.h>
+
+// Input transform from the AES basis to the tower field basis,
+// indexed by the low and high nibble respectively.
+static _Alignas(16) const uint8_t vperm_ipt_lo[16] = {
+  0x00, 0x01, 0x1c, 0x1d, 0x2d, 0x2c, 0x31, 0x30, 0x27, 0x26, 0x3b, 0x3a, 0x0a, 0x0b, 0x16, 0x17};
+
+static _Alignas(16) const uint8_t vperm_ipt_hi[16] = {
+  0x00, 0x86, 0xfd, 0x7b, 0x8e, 0x08, 0x73, 0xf5, 0x77, 0xf1, 0x8a, 0x0c, 0xf9, 0x7f, 0x04, 0x82};
+
+// Inverse in GF(2^4) and a times the inverse. Zero maps to 0x80,
+// which makes pshufb return zero for the exceptional cases.
+static _Alignas(16) const uint8_t vperm_inv[16] = {
+  0x80, 0x01, 0x09, 0x0e, 0x0d, 0x0b, 0x07, 0x06, 0x0f, 0x02, 0x0c, 0x05, 0x0a, 0x04, 0x03, 0x08};
+
+static _Alignas(16) const uint8_t vperm_inva[16] = {
+  0x80, 0x02, 0x01, 0x0f, 0x09, 0x05, 0x0e, 0x0c, 0x0d, 0x04, 0x0b, 0x0a, 0x07, 0x08, 0x06, 0x03};
+
+// Output tables giving the linear part of the S-box (sbu, sbt)
+// and two times the linear part (sb2u, sb2t) in the AES basis.
+static _Alignas(16) const uint8_t vperm_sbu[16] = {
+  0x00, 0xcb, 0xd7, 0xb0, 0x21, 0x8d, 0x67, 0xac, 0x7b, 0x5a, 0xea, 0x3d, 0x46, 0xf6, 0x91, 0x1c};
+
+static _Alignas(16) const uint8_t vperm_sbt[16] = {
+  0x00, 0x9f, 0x61, 0x16, 0xc2, 0x2a, 0x77, 0xe8, 0x89, 0x4b, 0x5d, 0x3c, 0xb5, 0xa3, 0xd4, 0xfe};
+
+static _Alignas(16) const uint8_t vperm_sb2u[16] = {
+  0x00, 0x8d, 0xb5, 0x7b, 0x42, 0x01, 0xce, 0x43, 0xf6, 0xb4, 0xcf, 0x7a, 0x8c, 0xf7, 0x39, 0x38};
+
+static _Alignas(16) const uint8_t vperm_sb2t[16] = {
+  0x00, 0x25, 0xc2, 0x2c, 0x9f, 0x54, 0xee, 0xcb, 0x09, 0x96, 0xba, 0x78, 0x71, 0x5d, 0xb3, 0xe7};
+
+// ShiftRows on a column-major block.
+static _Alignas(16) const uint8_t vperm_sr[16] = {
+  0x00, 0x05, 0x0a, 0x0f, 0x04, 0x09, 0x0e, 0x03, 0x08, 0x0d, 0x02, 0x07, 0x0c, 0x01, 0x06, 0x0b};
+
+// Rotate the bytes in each column up by one, two and three rows.
+static _Alignas(16) const uint8_t vperm_rot1[16] = {
+  0x01, 0x02, 0x03, 0x00, 0x05, 0x06, 0x07, 0x04, 0x09, 0x0a, 0x0b, 0x08, 0x0d, 0x0e, 0x0f, 0x0c};
+
+static _Alignas(16) const uint8_t vperm_rot2[16] = {
+  0x02, 0x03, 0x00, 0x01, 0x06, 0x07, 0x04, 0x05, 0x0a, 0x0b, 0x08, 0x09, 0x0e, 0x0f, 0x0c, 0x0d};
+
+static _Alignas(16) const uint8_t vperm_rot3[16] = {
+  0x03, 0x00, 0x01, 0x02, 0x07, 0x04, 0x05, 0x06, 0x0b, 0x08, 0x09, 0x0a, 0x0f, 0x0c, 0x0d, 0x0e};
+
+#define VPERM_LOAD(table) _mm_load_si128((const __m128i *) table)
+
+
+__attribute__((target("ssse3")))
+static inline __m128i vperm_round(__m128i x) {
+  const __m128i mask_0f = _mm_set1_epi8(0x0f);
+  const __m128i inv = VPERM_LOAD(vperm_inv);
+  __m128i i, j, k, ak, iak, jak, io, jo, s, d;
+
+  x = _mm_shuffle_epi8(x, VPERM_LOAD(vperm_sr));
+
+  // Change to the tower field basis and split into nibbles.
+  k = _mm_and_si128(x, mask_0f);
+  i = _mm_and_si128(_mm_srli_epi16(x, 4), mask_0f);
+  x = _mm_xor_si128(_mm_shuffle_epi8(VPERM_LOAD(vperm_ipt_lo), k),
+                    _mm_shuffle_epi8(VPERM_LOAD(vperm_ipt_hi), i));
+  k = _mm_and_si128(x, mask_0f);
+  i = _mm_and_si128(_mm_srli_epi16(x, 4), mask_0f);
+  j = _mm_xor_si128(i, k);
+
+  // Inversion.
+  ak  = _mm_shuffle_epi8(VPERM_LOAD(vperm_inva), k);
+  iak = _mm_xor_si128(_mm_shuffle_epi8(inv, i), ak);
+  jak = _mm_xor_si128(_mm_shuffle_epi8(inv, j), ak);
+  io  = _mm_xor_si128(_mm_shuffle_epi8(inv, iak), j);
+  jo  = _mm_xor_si128(_mm_shuffle_epi8(inv, jak), i);
+
+  // Linear part of SubBytes, and two times that.
+  s = _mm_xor_si128(_mm_shuffle_epi8(VPERM_LOAD(vperm_sbu), io),
+                    _mm_shuffle_epi8(VPERM_LOAD(vperm_sbt), jo));
+  d = _mm_xor_si128(_mm_shuffle_epi8(VPERM_LOAD(vperm_sb2u), io),
+                    _mm_shuffle_epi8(VPERM_LOAD(vperm_sb2t), jo));
+
+  // MixColumns: 2*s[r] + 3*s[r + 1] + s[r + 2] + s[r + 3]. The affine
+  // constants of the four terms sum to 0x63.
+  x = _mm_xor_si128(d, _mm_shuffle_epi8(_mm_xor_si128(d, s),
+                                        VPERM_LOAD(vperm_rot1)));
+  x = _mm_xor_si128(x, _mm_shuffle_epi8(s, VPERM_LOAD(vperm_rot2)));
+  x = _mm_xor_si128(x, _mm_shuffle_epi8(s, VPERM_LOAD(vperm_rot3)));
+  x = _mm_xor_si128(x, _mm_set1_epi8(0x63));
+
+  return x;
+}
+
+
+__attribute__((target("ssse3")))
+void aes_round_vperm(const uint8_t *block_in, uint8_t *block_out) {
+  __m128i x = _mm_loadu_si128((const __m128i *) block_in);
+
+  _mm_storeu_si128((__m128i *) block_out, vperm_round(x));
+}
+
+
+// Both blocks are loaded before the rounds, so the outputs may alias
+// the inputs, and the two dependency chains can be interleaved.
+__attribute__((target("ssse3")))
+void aes_round_vperm_x2(const uint8_t *in0, uint8_t *out0,
+			const uint8_t *in1, uint8_t *out1) {
+  __m128i x0 = _mm_loadu_si128((const __m128i *) in0);
+  __m128i x1 = _mm_loadu_si128((const __m128i *) in1);
+
+  x0 = vperm_round(x0);
+  x1 = vperm_round(x1);
+  _mm_storeu_si128((__m128i *) out0, x0);
+  _mm_storeu_si128((__m128i *) out1, x1);
+}
+
+
+__attribute__((target("ssse3")))
+void aes_round_vperm_n(const uint8_t *block_in, uint8_t *block_out, int n) {
+  const __m128i *in = (const __m128i *) block_in;
+  __m128i *out = (__m128i *) block_out;
+  int i = 0;
+
+  for ( ; i + 2 <= n ; i += 2) {
+    __m128i x0 = _mm_loadu_si128(&in[i]);
+    __m128i x1 = _mm_loadu_si128(&in[i + 1]);
+
+    x0 = vperm_round(x0);
+    x1 = vperm_round(x1);
+    _mm_storeu_si128(&out[i], x0);
+    _mm_storeu_si128(&out[i + 1], x1);
+  }
+
+  if (i < n) {
+    _mm_storeu_si128(&out[i], vperm_round(_mm_loadu_si128(&in[i])));
+  }
+}
+
+#else
+
+// Never selected on non-x86 targets.
+void aes_round_vperm(const uint8_t *block_in, uint8_t *block_out) {
+  aes_round_ref(block_in, block_out);
+}
+
+void aes_round_vperm_x2(const uint8_t *in0, uint8_t *out0,
+			const uint8_t *in1, uint8_t *out1) {
+  aes_round_ref_x2(in0, out0, in1, out1);
+}
+
+void aes_round_vperm_n(const uint8_t *block_in, uint8_t *block_out, int n) {
+  aes_round_ref_n(block_in, block_out, n);
+}
+
+#endif
+
+
+//=======================================================================
+// EOF snow_vi_aes_round_vperm.c
+//=======================================================================
@@ -0,0 +1,205 @@
+//=======================================================================
+// snow_vi_arena.c
+// ---------------
+// Arena of session contexts. The groups are allocated in one region
+// aligned to the huge page size, so the arena is covered by few TLB
+// entries. On systems without mmap() the region comes from
+// aligned_alloc().
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+#include "snow_vi_arena.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+
+// Map size bytes aligned to HUGE_PAGE_SIZE, trimming the unaligned
+// head and tail of a larger mapping. Returns NULL on failure.
+static void *map_aligned(size_t size) {
+#if defined(MAP_ANONYMOUS)
+  size_t map_size = size + HUGE_PAGE_SIZE;
+  uint8_t *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  size_t head;
+
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  head = (HUGE_PAGE_SIZE - ((uintptr_t) p & (HUGE_PAGE_SIZE - 1))) & (HUGE_PAGE_SIZE - 1);
+  if (head != 0) {
+    munmap(p, head);
+  }
+  if (map_size - head - size != 0) {
+    munmap(p + head + size, map_size - head - size);
+  }
+
+#if defined(MADV_HUGEPAGE)
+  madvise(p + head, size, MADV_HUGEPAGE);
+#endif
+  return p + head;
+
+#else
+  (void) size;
+  return NULL;
+#endif
+}
+
+
+int snow_vi_arena_create(struct snow_vi_arena *arena, size_t capacity) {
+  size_t num_groups = (capacity + SNOW_VI_MULTI_LANES - 1) / SNOW_VI_MULTI_LANES;
+  size_t size = num_groups * sizeof(struct snow_vi_multi);
+  size_t num = num_groups * SNOW_VI_MULTI_LANES;
+
+  memset(arena, 0, sizeof(*arena));
+  if ((num_groups == 0) || (num > UINT32_MAX)) {
+    return -1;
+  }
+
+  size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  arena->mem = map_aligned(size);
+  arena->mapped = (arena->mem != NULL);
+  if (arena->mem == NULL) {
+    arena->mem = aligned_alloc(HUGE_PAGE_SIZE, size);
+  }
+
+  arena->free_list = malloc(num * sizeof(uint32_t));
+  arena->in_use = calloc((num + 63) / 64, sizeof(uint64_t));
+  if ((arena->mem == NULL) || (arena->free_list == NULL) || (arena->in_use == NULL)) {
+    arena->mem_size = size;
+    snow_vi_arena_destroy(arena);
+    return -1;
+  }
+
+  // Anonymous mappings are zeroed, allocated memory is not.
+  if (!arena->mapped) {
+    memset(arena->mem, 0, size);
+  }
+
+  arena->groups = arena->mem;
+  arena->num_groups = num_groups;
+  arena->mem_size = size;
+  for (size_t g = 0 ; g < num_groups ; g++) {
+    arena->groups[g].lanes = SNOW_VI_MULTI_LANES;
+  }
+
+  // Hand out the handles in increasing order, filling one group at a
+  // time.
+  for (size_t i = 0 ; i < num ; i++) {
+    arena->free_list[i] = (uint32_t) (num - 1 - i);
+  }
+  arena->num_free = num;
+
+  return 0;
+}
+
+
+void snow_vi_arena_destroy(struct snow_vi_arena *arena) {
+  if (arena->mem != NULL) {
+#if defined(MAP_ANONYMOUS)
+    if (arena->mapped) {
+      munmap(arena->mem, arena->mem_size);
+    }
+    else {
+      free(arena->mem);
+    }
+#else
+    free(arena->mem);
+#endif
+  }
+  free(arena->free_list);
+  free(arena->in_use);
+
+  memset(arena, 0, sizeof(*arena));
+}
+
+
+int snow_vi_arena_acquire(struct snow_vi_arena *arena, const uint8_t *key,
+			  const uint8_t *iv, uint32_t *handle) {
+  struct snow_vi_ctx ctx;
+
+  if (arena->num_free == 0) {
+    return -1;
+  }
+
+  *handle = arena->free_list[--arena->num_free];
+  arena->in_use[*handle / 64] |= (uint64_t) 1 << (*handle % 64);
+  snow_vi_init(&ctx, key, iv);
+  snow_vi_arena_store(arena, *handle, &ctx);
+
+  return 0;
+}
+
+
+int snow_vi_arena_release(struct snow_vi_arena *arena, uint32_t handle) {
+  struct snow_vi_ctx ctx;
+  uint64_t bit = (uint64_t) 1 << (handle % 64);
+
+  if ((SNOW_VI_ARENA_GROUP(handle) >= arena->num_groups) ||
+      ((arena->in_use[handle / 64] & bit) == 0)) {
+    return -1;
+  }
+
+  memset(&ctx, 0, sizeof(ctx));
+  snow_vi_arena_store(arena, handle, &ctx);
+  arena->in_use[handle / 64] &= ~bit;
+  arena->free_list[arena->num_free++] = handle;
+  return 0;
+}
+
+
+void snow_vi_arena_load(const struct snow_vi_arena *arena, uint32_t handle,
+			struct snow_vi_ctx *ctx) {
+  snow_vi_multi_get_lane(&arena->groups[SNOW_VI_ARENA_GROUP(handle)],
+			 SNOW_VI_ARENA_LANE(handle), ctx);
+}
+
+
+void snow_vi_arena_store(struct snow_vi_arena *arena, uint32_t handle,
+			 const struct snow_vi_ctx *ctx) {
+  snow_vi_multi_set_lane(&arena->groups[SNOW_VI_ARENA_GROUP(handle)],
+			 SNOW_VI_ARENA_LANE(handle), ctx);
+}
+
+//=======================================================================
+// EOF snow_vi_arena.c
+//=======================================================================
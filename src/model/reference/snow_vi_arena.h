@@ -0,0 +1,108 @@
+//=======================================================================
+// snow_vi_arena.h
+// ---------------
+// Arena of session contexts in the structure of arrays layout of the
+// multi-stream engines. Contexts are grouped SNOW_VI_MULTI_LANES to a
+// group, and each group is a struct snow_vi_multi that can be passed
+// directly to snow_vi_multi_keystream().
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_arena_h
+#define snow_vi_arena_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+
+// A handle is the index of a context in the arena, and stays valid
+// until it is released. Context h is lane h % SNOW_VI_MULTI_LANES of
+// group h / SNOW_VI_MULTI_LANES.
+#define SNOW_VI_ARENA_GROUP(h) ((h) / SNOW_VI_MULTI_LANES)
+#define SNOW_VI_ARENA_LANE(h) ((int) ((h) % SNOW_VI_MULTI_LANES))
+
+struct snow_vi_arena {
+  struct snow_vi_multi *groups;
+  size_t num_groups;
+
+  // Stack of free handles, acquire pops and release pushes. Bit h of
+  // in_use is set while handle h is acquired.
+  uint32_t *free_list;
+  size_t num_free;
+  uint64_t *in_use;
+
+  void *mem;
+  size_t mem_size;
+  int mapped;
+};
+
+// Create an arena for at least capacity contexts. The groups are
+// allocated in one region, backed by transparent huge pages where
+// available. Returns 0 on success and -1 if memory could not be
+// allocated.
+int snow_vi_arena_create(struct snow_vi_arena *arena, size_t capacity);
+
+// Free the arena. All handles become invalid.
+void snow_vi_arena_destroy(struct snow_vi_arena *arena);
+
+// Acquire a context and initialize it with the given key and iv. The
+// handle is written to handle. Returns 0 on success and -1 if the
+// arena is full.
+int snow_vi_arena_acquire(struct snow_vi_arena *arena, const uint8_t *key,
+			  const uint8_t *iv, uint32_t *handle);
+
+// Release a context. Its state is cleared. Returns 0 on success and
+// -1 if the handle is outside of the arena or not acquired.
+int snow_vi_arena_release(struct snow_vi_arena *arena, uint32_t handle);
+
+// The group of SNOW_VI_MULTI_LANES contexts with index g. Lanes of
+// released or never acquired contexts are cleared and can be advanced
+// with the others.
+static inline struct snow_vi_multi *snow_vi_arena_group(struct snow_vi_arena *arena,
+							 size_t g) {
+  return &arena->groups[g];
+}
+
+// Copy a single context between the arena and a context, for example
+// to run a job on one session. The context must not have a partially
+// consumed keystream block when stored.
+void snow_vi_arena_load(const struct snow_vi_arena *arena, uint32_t handle,
+			struct snow_vi_ctx *ctx);
+void snow_vi_arena_store(struct snow_vi_arena *arena, uint32_t handle,
+			 const struct snow_vi_ctx *ctx);
+
+#endif // snow_vi_arena_h
+
+//=======================================================================
+// EOF snow_vi_arena.h
+//=======================================================================
@@ -0,0 +1,179 @@
+//=======================================================================
+// snow_vi_bench.c
+// ---------------
+// Benchmark driver for the session scheduler. Encrypts jobs from many
+// sessions with an increasing number of worker threads, and reports
+// the aggregate throughput and the scaling relative to one thread.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "snow_vi.h"
+#include "snow_vi_sched.h"
+
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+
+static void usage(const char *name) {
+  printf("Usage: %s [--sessions n] [--threads n] [--size bytes] [--jobs n]\n", name);
+  printf("  --sessions: Number of sessions, default 1024.\n");
+  printf("  --threads:  Maximum number of worker threads, default 4.\n");
+  printf("  --size:     Bytes per job, default 16384.\n");
+  printf("  --jobs:     Jobs per session, default 16.\n");
+}
+
+
+// Encrypt jobs jobs of size bytes for each of the sessions with
+// threads workers. Returns the throughput in GB/s, or a negative
+// value if the scheduler could not be started.
+static double run(int sessions, int threads, size_t size, int jobs) {
+  struct snow_vi_session *s;
+  struct snow_vi_job *job;
+  struct snow_vi_sched sched;
+  uint8_t *buf;
+  uint8_t key[32];
+  uint8_t iv[16];
+  double start, stop;
+
+  s = aligned_alloc(_Alignof(struct snow_vi_session),
+		    (size_t) sessions * sizeof(struct snow_vi_session));
+  job = calloc((size_t) sessions * (size_t) jobs, sizeof(struct snow_vi_job));
+  buf = calloc((size_t) sessions, size);
+  if ((s == NULL) || (job == NULL) || (buf == NULL) ||
+      (snow_vi_sched_start(&sched, threads) != 0)) {
+    free(s);
+    free(job);
+    free(buf);
+    return -1.0;
+  }
+
+  memset(key, 0x5a, sizeof(key));
+  memset(iv, 0, sizeof(iv));
+  for (int i = 0 ; i < sessions ; i++) {
+    memcpy(iv, &i, sizeof(i));
+    snow_vi_session_init(&s[i], key, iv);
+  }
+
+  start = now();
+  for (int j = 0 ; j < jobs ; j++) {
+    for (int i = 0 ; i < sessions ; i++) {
+      struct snow_vi_job *p = &job[(size_t) j * (size_t) sessions + (size_t) i];
+
+      p->in = &buf[(size_t) i * size];
+      p->out = &buf[(size_t) i * size];
+      p->len = size;
+      snow_vi_sched_submit(&sched, &s[i], p);
+    }
+  }
+  snow_vi_sched_wait(&sched);
+  stop = now();
+
+  snow_vi_sched_stop(&sched);
+  for (int i = 0 ; i < sessions ; i++) {
+    snow_vi_session_destroy(&s[i]);
+  }
+  free(s);
+  free(job);
+  free(buf);
+
+  return (double) sessions * (double) jobs * (double) size / (stop - start) / 1e9;
+}
+
+
+int main(int argc, char *argv[]) {
+  int sessions = 1024;
+  int threads = 4;
+  long size = 16384;
+  int jobs = 16;
+  double base = 0.0;
+
+  for (int i = 1 ; i < argc ; i++) {
+    if ((i + 1 < argc) && (strcmp(argv[i], "--sessions") == 0)) {
+      sessions = atoi(argv[++i]);
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--threads") == 0)) {
+      threads = atoi(argv[++i]);
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--size") == 0)) {
+      size = atol(argv[++i]);
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--jobs") == 0)) {
+      jobs = atoi(argv[++i]);
+    }
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if ((sessions < 1) || (threads < 1) || (threads > SNOW_VI_SCHED_MAX_THREADS) ||
+      (size < 1) || (jobs < 1)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  printf("snow_vi_bench: %d sessions, %d jobs of %ld bytes per session.\n\n",
+	 sessions, jobs, size);
+  printf("threads      GB/s   speedup  efficiency\n");
+
+  for (int t = 1 ; t <= threads ; t = (t < threads && 2 * t > threads) ? threads : 2 * t) {
+    double gbps = run(sessions, t, (size_t) size, jobs);
+
+    if (gbps < 0.0) {
+      printf("Could not start the scheduler with %d threads.\n", t);
+      return 1;
+    }
+
+    if (t == 1) {
+      base = gbps;
+    }
+    printf("%7d  %8.2f  %8.2f  %9.0f%%\n", t, gbps, gbps / base,
+	   100.0 * gbps / base / t);
+  }
+
+  return 0;
+}
+
+//=======================================================================
+// EOF snow_vi_bench.c
+//=======================================================================
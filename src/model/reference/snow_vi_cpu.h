@@ -0,0 +1,117 @@
+//=======================================================================
+// snow_vi_cpu.h
+// -------------
+// Compile time platform detection and run time CPU feature queries
+// used to select between the portable code and the x86 SIMD backends.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_cpu_h
+#define snow_vi_cpu_h
+
+// SNOW_VI_X86 is set when we can use x86 intrinsics together with
+// function level target attributes. This allows the SIMD backends to be
+// built without global -m flags and selected at run time.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SNOW_VI_X86 1
+#else
+#define SNOW_VI_X86 0
+#endif
+
+// SNOW_VI_SSE2 is set when SSE2 is part of the target baseline and can
+// be used without a run time check. Building with -DSNOW_VI_NO_SIMD
+// forces the portable code paths, except for AES-NI.
+#if defined(__SSE2__) && !defined(SNOW_VI_NO_SIMD)
+#define SNOW_VI_SSE2 1
+#else
+#define SNOW_VI_SSE2 0
+#endif
+
+
+// Returns non-zero if the CPU supports the AES-NI instructions.
+// Building with -DSNOW_VI_NO_AESNI forces the portable code paths.
+static inline int snow_vi_cpu_has_aesni(void) {
+#if SNOW_VI_X86 && !defined(SNOW_VI_NO_AESNI)
+  return __builtin_cpu_supports("aes");
+#else
+  return 0;
+#endif
+}
+
+
+// Returns non-zero if the CPU supports SSSE3 (pshufb).
+static inline int snow_vi_cpu_has_ssse3(void) {
+#if SNOW_VI_X86 && !defined(SNOW_VI_NO_SIMD)
+  return __builtin_cpu_supports("ssse3");
+#else
+  return 0;
+#endif
+}
+
+
+// Returns non-zero if the CPU supports the carry-less multiply
+// instruction PCLMULQDQ.
+static inline int snow_vi_cpu_has_pclmul(void) {
+#if SNOW_VI_X86 && !defined(SNOW_VI_NO_SIMD)
+  return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#else
+  return 0;
+#endif
+}
+
+
+// Returns non-zero if the CPU supports AVX2.
+static inline int snow_vi_cpu_has_avx2(void) {
+#if SNOW_VI_X86 && !defined(SNOW_VI_NO_SIMD)
+  return __builtin_cpu_supports("avx2");
+#else
+  return 0;
+#endif
+}
+
+
+// Returns non-zero if the CPU supports the AVX-512 foundation and byte
+// and word instructions together with VAES.
+static inline int snow_vi_cpu_has_avx512_vaes(void) {
+#if SNOW_VI_X86 && !defined(SNOW_VI_NO_SIMD) && !defined(SNOW_VI_NO_AESNI)
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+    __builtin_cpu_supports("vaes");
+#else
+  return 0;
+#endif
+}
+
+#endif // snow_vi_cpu_h
+
+//=======================================================================
+// EOF snow_vi_cpu.h
+//=======================================================================
@@ -0,0 +1,453 @@
+//=======================================================================
+// snow_vi_crypt.c
+// ---------------
+// Command line tool for encrypting and decrypting files. The input and
+// output are memory mapped, so the data is never copied through
+// read() and write() buffers.
+//
+// In the default stream mode the file is one stream. A producer thread
+// generates the keystream into a prefetch ring holding two windows,
+// while the calling thread XORs the previous window into the output
+// and starts its write-back. In the chunked mode the output is a
+// container in the format of snow_vi_file.h, and the chunks are
+// processed on all cores.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snow_vi.h"
+#include "snow_vi_drbg.h"
+#include "snow_vi_prefetch.h"
+#include "snow_vi_file.h"
+
+// Bytes XORed between two write-back requests in the stream mode. The
+// prefetch ring holds two windows, one being XORed while the producer
+// fills the other. A multiple of the page size.
+#define WINDOW (256 * 1024)
+
+
+struct mapping {
+  int fd;
+  uint8_t *data;
+  size_t len;
+};
+
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+
+static void usage(const char *name) {
+  printf("Usage: %s [-e | -d] [--chunked] [--threads n] [--chunk-size bytes]\n", name);
+  printf("       %*s --key-file path [--iv hex] in [out]\n", (int) strlen(name), "");
+  printf("  -e, -d:       Encrypt or decrypt, default encrypt. In the stream\n");
+  printf("                mode both are the same operation.\n");
+  printf("  --chunked:    Write or read a chunked container instead of a stream.\n");
+  printf("  --threads:    Threads for the chunked mode, default all cores.\n");
+  printf("  --chunk-size: Chunk size for chunked encryption, default %d.\n",
+	 SNOW_VI_FILE_DEFAULT_CHUNK);
+  printf("  --key-file:   File with the 256 bit key as 64 hex digits, for\n");
+  printf("                example /dev/fd/3 to pass it on a descriptor. If not\n");
+  printf("                given, the key is taken from SNOW_VI_KEY in the\n");
+  printf("                environment.\n");
+  printf("  --iv:         128 bit iv as 32 hex digits, required in the stream\n");
+  printf("                mode. For chunked encryption it is the iv base, whose\n");
+  printf("                last 16 digits must be zero, and a random base is used\n");
+  printf("                if it is not given. Not used when decrypting a\n");
+  printf("                container, which holds its iv base.\n");
+  printf("  If out is not given or is the same file as in, in is replaced with\n");
+  printf("  the result. This is only possible in the stream mode.\n");
+}
+
+
+// Parse 2 * len hex digits into out. Returns 0 on success and -1 if
+// the string has the wrong length or is not hex.
+static int parse_hex(const char *s, uint8_t *out, size_t len) {
+  if (strlen(s) != 2 * len) {
+    return -1;
+  }
+
+  for (size_t i = 0 ; i < 2 * len ; i++) {
+    char c = s[i];
+    int v;
+
+    if ((c >= '0') && (c <= '9')) {
+      v = c - '0';
+    }
+    else if ((c >= 'a') && (c <= 'f')) {
+      v = c - 'a' + 10;
+    }
+    else if ((c >= 'A') && (c <= 'F')) {
+      v = c - 'A' + 10;
+    }
+    else {
+      return -1;
+    }
+
+    if ((i & 1) == 0) {
+      out[i / 2] = (uint8_t) (v << 4);
+    }
+    else {
+      out[i / 2] |= (uint8_t) v;
+    }
+  }
+  return 0;
+}
+
+
+// Read the key as 64 hex digits, optionally followed by white space,
+// from the file at path. Returns 0 on success and -1 with an error
+// message on failure.
+static int read_key_file(const char *path, uint8_t *key) {
+  char buf[128];
+  ssize_t n;
+  int fd = open(path, O_RDONLY);
+  int result = -1;
+
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n < 0) {
+    perror(path);
+    return -1;
+  }
+
+  while ((n > 0) && ((buf[n - 1] == '\n') || (buf[n - 1] == '\r') ||
+		     (buf[n - 1] == ' ') || (buf[n - 1] == '\t'))) {
+    n--;
+  }
+  buf[n] = 0;
+
+  if (parse_hex(buf, key, 32) == 0) {
+    result = 0;
+  }
+  else {
+    fprintf(stderr, "%s: the key must be 64 hex digits.\n", path);
+  }
+
+  snow_vi_wipe(buf, sizeof(buf));
+  return result;
+}
+
+
+// Map the file at path, for writing if writable is set. Returns 0 on
+// success and -1 with an error message on failure.
+static int map_input(struct mapping *m, const char *path, int writable) {
+  struct stat st;
+
+  m->data = NULL;
+  m->fd = open(path, writable ? O_RDWR : O_RDONLY);
+  if ((m->fd < 0) || (fstat(m->fd, &st) != 0)) {
+    perror(path);
+    return -1;
+  }
+
+  m->len = (size_t) st.st_size;
+  if (m->len == 0) {
+    return 0;
+  }
+
+  m->data = mmap(NULL, m->len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+		 MAP_SHARED, m->fd, 0);
+  if (m->data == MAP_FAILED) {
+    perror(path);
+    m->data = NULL;
+    return -1;
+  }
+
+  posix_madvise(m->data, m->len, POSIX_MADV_SEQUENTIAL);
+  return 0;
+}
+
+
+// Create the file at path with len bytes and map it for writing.
+// Returns 0 on success and -1 with an error message on failure.
+static int map_output(struct mapping *m, const char *path, size_t len) {
+  m->data = NULL;
+  m->len = len;
+  m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if ((m->fd < 0) || (ftruncate(m->fd, (off_t) len) != 0)) {
+    perror(path);
+    return -1;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  m->data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+  if (m->data == MAP_FAILED) {
+    perror(path);
+    m->data = NULL;
+    return -1;
+  }
+
+  posix_madvise(m->data, m->len, POSIX_MADV_SEQUENTIAL);
+  return 0;
+}
+
+
+// Returns non-zero if path names the same file as a, which must exist,
+// for example through a link.
+static int same_file(const char *a, const char *path) {
+  struct stat sa, sb;
+
+  return (stat(a, &sa) == 0) && (stat(path, &sb) == 0) &&
+    (sa.st_dev == sb.st_dev) && (sa.st_ino == sb.st_ino);
+}
+
+
+static void unmap(struct mapping *m) {
+  if (m->data != NULL) {
+    munmap(m->data, m->len);
+  }
+  if (m->fd >= 0) {
+    close(m->fd);
+  }
+}
+
+
+// XOR the keystream of ctx into len bytes from in and write them to
+// out, with the keystream generated by a producer thread. Returns the
+// number of times the XOR had to wait for keystream, or -1 if the
+// producer could not be started.
+static long crypt_stream(const struct snow_vi_ctx *ctx, const uint8_t *in,
+			 uint8_t *out, size_t len) {
+  struct snow_vi_prefetch pf;
+  long underruns;
+
+  if (snow_vi_prefetch_start(&pf, ctx, 2 * WINDOW / 16) != 0) {
+    return -1;
+  }
+
+  for (size_t pos = 0 ; pos < len ; pos += WINDOW) {
+    size_t n = (len - pos < WINDOW) ? len - pos : WINDOW;
+
+    snow_vi_prefetch_xor(&pf, &in[pos], &out[pos], n);
+
+    // Have the kernel start writing back the finished window while
+    // the next one is processed.
+    msync(&out[pos], n, MS_ASYNC);
+  }
+
+  underruns = (long) snow_vi_prefetch_underruns(&pf);
+  snow_vi_prefetch_stop(&pf);
+  return underruns;
+}
+
+
+int main(int argc, char *argv[]) {
+  struct snow_vi_file_header hdr;
+  struct snow_vi_ctx ctx;
+  struct mapping in = {-1, NULL, 0};
+  struct mapping out = {-1, NULL, 0};
+  const char *in_path = NULL;
+  const char *out_path = NULL;
+  uint8_t key[32];
+  uint8_t iv[16];
+  int have_key = 0;
+  int have_iv = 0;
+  int decrypt = 0;
+  int chunked = 0;
+  int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  long chunk_size = SNOW_VI_FILE_DEFAULT_CHUNK;
+  long underruns = 0;
+  size_t len;
+  double start, stop;
+  int result = 1;
+
+  for (int i = 1 ; i < argc ; i++) {
+    if (strcmp(argv[i], "-e") == 0) {
+      decrypt = 0;
+    }
+    else if (strcmp(argv[i], "-d") == 0) {
+      decrypt = 1;
+    }
+    else if (strcmp(argv[i], "--chunked") == 0) {
+      chunked = 1;
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--threads") == 0)) {
+      threads = atoi(argv[++i]);
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--chunk-size") == 0)) {
+      chunk_size = atol(argv[++i]);
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--key-file") == 0)) {
+      if (read_key_file(argv[++i], key) != 0) {
+	goto done;
+      }
+      have_key = 1;
+    }
+    else if ((i + 1 < argc) && (strcmp(argv[i], "--iv") == 0)) {
+      have_iv = (parse_hex(argv[++i], iv, sizeof(iv)) == 0);
+    }
+    else if ((argv[i][0] != '-') && (in_path == NULL)) {
+      in_path = argv[i];
+    }
+    else if ((argv[i][0] != '-') && (out_path == NULL)) {
+      out_path = argv[i];
+    }
+    else {
+      usage(argv[0]);
+      goto done;
+    }
+  }
+
+  // The key is never taken from the command line, where other users
+  // can read it.
+  if (!have_key && (getenv("SNOW_VI_KEY") != NULL)) {
+    have_key = (parse_hex(getenv("SNOW_VI_KEY"), key, sizeof(key)) == 0);
+  }
+
+  if ((in_path == NULL) || !have_key || (!have_iv && !chunked) ||
+      (chunked && (out_path == NULL)) || (threads < 1) || (chunk_size < 16) ||
+      (chunk_size > UINT32_MAX) || ((chunk_size % 16) != 0)) {
+    usage(argv[0]);
+    goto done;
+  }
+
+  // Creating the output would truncate the input if they are the same
+  // file. The stream mode then works in place, the chunked mode
+  // changes the size and can not.
+  if ((out_path != NULL) && same_file(in_path, out_path)) {
+    if (chunked) {
+      fprintf(stderr, "%s: the chunked mode can not write to its input.\n", out_path);
+      goto done;
+    }
+    out_path = NULL;
+  }
+
+  if (map_input(&in, in_path, out_path == NULL) != 0) {
+    goto done;
+  }
+  len = in.len;
+
+  if (!chunked) {
+    if ((out_path != NULL) && (map_output(&out, out_path, len) != 0)) {
+      goto done;
+    }
+
+    start = now();
+    if (len > 0) {
+      snow_vi_init(&ctx, key, iv);
+      underruns = crypt_stream(&ctx, in.data, out_path != NULL ? out.data : in.data, len);
+      snow_vi_wipe(&ctx, sizeof(ctx));
+    }
+    stop = now();
+
+    if (underruns < 0) {
+      fprintf(stderr, "Could not start the keystream thread.\n");
+      goto done;
+    }
+  }
+
+  else if (!decrypt) {
+    // A user chosen base is easily reused, so the default is a random
+    // one. The last 8 bytes are reserved for the chunk index.
+    if (!have_iv) {
+      memset(iv, 0, sizeof(iv));
+      if (snow_vi_random(iv, 8) != 0) {
+	fprintf(stderr, "Could not generate a random iv base.\n");
+	goto done;
+      }
+    }
+    else if (snow_vi_check_iv_base(iv) != 0) {
+      fprintf(stderr, "The last 16 digits of the iv base must be zero.\n");
+      goto done;
+    }
+
+    hdr.chunk_size = (uint32_t) chunk_size;
+    hdr.data_len = len;
+    memcpy(hdr.iv_base, iv, 16);
+    if (map_output(&out, out_path, SNOW_VI_FILE_HEADER_SIZE + len) != 0) {
+      goto done;
+    }
+
+    start = now();
+    if (snow_vi_file_encrypt(&hdr, key, in.data, out.data, threads) != 0) {
+      fprintf(stderr, "Invalid container header.\n");
+      goto done;
+    }
+    stop = now();
+  }
+
+  else {
+    if ((in.data == NULL) || (snow_vi_file_read_header(&hdr, in.data, in.len) != 0) ||
+	(hdr.data_len != in.len - SNOW_VI_FILE_HEADER_SIZE)) {
+      fprintf(stderr, "%s: not a valid container.\n", in_path);
+      goto done;
+    }
+    len = (size_t) hdr.data_len;
+    if (map_output(&out, out_path, len) != 0) {
+      goto done;
+    }
+
+    start = now();
+    snow_vi_file_decrypt(key, in.data, in.len, out.data, threads);
+    stop = now();
+  }
+
+  fprintf(stderr, "%zu bytes in %.3f s, %.2f GB/s", len, stop - start,
+	  (stop > start) ? 1e-9 * (double) len / (stop - start) : 0.0);
+  if (!chunked) {
+    fprintf(stderr, ", %ld keystream underruns", underruns);
+  }
+  fprintf(stderr, ".\n");
+  result = 0;
+
+ done:
+  snow_vi_wipe(key, sizeof(key));
+  unmap(&out);
+  unmap(&in);
+  return result;
+}
+
+//=======================================================================
+// EOF snow_vi_crypt.c
+//=======================================================================
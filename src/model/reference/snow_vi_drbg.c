@@ -0,0 +1,253 @@
+//=======================================================================
+// snow_vi_drbg.c
+// --------------
+// Deterministic random bit generator. A request of n blocks per lane
+// is written by lane l to the n blocks at offset 16 * n * l of the
+// output, so bulk requests run at the speed of the multi-stream
+// engine without copying.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+#include "snow_vi_drbg.h"
+
+#define LANES SNOW_VI_MULTI_LANES
+
+// Incremented in the child on each fork().
+static atomic_uint fork_gen;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+// The generator of each thread, wiped by the destructor of thread_key
+// when the thread exits.
+static _Thread_local struct snow_vi_drbg thread_drbg;
+static _Thread_local int thread_seeded;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+
+static void fork_child(void) {
+  atomic_fetch_add(&fork_gen, 1);
+}
+
+
+static void fork_register(void) {
+  pthread_atfork(NULL, NULL, fork_child);
+}
+
+
+static void thread_drbg_destroy(void *drbg) {
+  snow_vi_drbg_destroy(drbg);
+  thread_seeded = 0;
+}
+
+
+static void thread_key_create(void) {
+  pthread_key_create(&thread_key, thread_drbg_destroy);
+}
+
+
+// Initialize the lanes, lane l with the iv with l added with XOR to
+// its last byte, and drop the buffered output of the old key.
+static void seed_lanes(struct snow_vi_drbg *drbg, const uint8_t *key,
+		       const uint8_t *iv) {
+  uint8_t ivs[LANES][16];
+  const uint8_t *key_ptr[LANES];
+  const uint8_t *iv_ptr[LANES];
+
+  for (int l = 0 ; l < LANES ; l++) {
+    memcpy(ivs[l], iv, 16);
+    ivs[l][15] ^= (uint8_t) l;
+    key_ptr[l] = key;
+    iv_ptr[l] = ivs[l];
+  }
+
+  snow_vi_multi_init(&drbg->m, LANES, key_ptr, iv_ptr);
+  memset(drbg->buf, 0, sizeof(drbg->buf));
+  drbg->buf_pos = sizeof(drbg->buf);
+  snow_vi_wipe(ivs, sizeof(ivs));
+}
+
+
+// Generate without the reseed checks.
+static void generate(struct snow_vi_drbg *drbg, uint8_t *out, size_t len) {
+  uint8_t *ptr[LANES];
+  size_t n;
+
+  // Buffered bytes first.
+  n = sizeof(drbg->buf) - drbg->buf_pos;
+  if (n > len) {
+    n = len;
+  }
+  memcpy(out, &drbg->buf[drbg->buf_pos], n);
+  memset(&drbg->buf[drbg->buf_pos], 0, n);
+  drbg->buf_pos += n;
+  out += n;
+  len -= n;
+
+  // Whole blocks per lane directly into the output.
+  n = len / sizeof(drbg->buf);
+  if (n > 0) {
+    for (int l = 0 ; l < LANES ; l++) {
+      ptr[l] = &out[16 * n * (size_t) l];
+    }
+    snow_vi_multi_keystream(&drbg->m, ptr, n);
+    out += n * sizeof(drbg->buf);
+    len -= n * sizeof(drbg->buf);
+  }
+
+  if (len > 0) {
+    for (int l = 0 ; l < LANES ; l++) {
+      ptr[l] = &drbg->buf[16 * l];
+    }
+    snow_vi_multi_keystream(&drbg->m, ptr, 1);
+    memcpy(out, drbg->buf, len);
+    memset(drbg->buf, 0, len);
+    drbg->buf_pos = len;
+  }
+}
+
+
+// Replace the key and iv with the next output of the generator, with
+// seed added with XOR if it is not NULL. The old key cannot be
+// recovered from the new state.
+static void rekey(struct snow_vi_drbg *drbg, const uint8_t *seed) {
+  uint8_t next[SNOW_VI_DRBG_SEED_SIZE];
+
+  generate(drbg, next, sizeof(next));
+  if (seed != NULL) {
+    for (size_t i = 0 ; i < sizeof(next) ; i++) {
+      next[i] ^= seed[i];
+    }
+  }
+  seed_lanes(drbg, &next[0], &next[32]);
+  snow_vi_wipe(next, sizeof(next));
+}
+
+
+void snow_vi_drbg_init(struct snow_vi_drbg *drbg, const uint8_t *key,
+		       const uint8_t *iv) {
+  pthread_once(&fork_once, fork_register);
+  seed_lanes(drbg, key, iv);
+  drbg->generated = 0;
+  drbg->reseed_interval = SNOW_VI_DRBG_RESEED_INTERVAL;
+  drbg->fork_gen = atomic_load(&fork_gen);
+}
+
+
+void snow_vi_drbg_destroy(struct snow_vi_drbg *drbg) {
+  snow_vi_wipe(drbg, sizeof(*drbg));
+}
+
+
+int snow_vi_drbg_reseed(struct snow_vi_drbg *drbg, const uint8_t *seed) {
+  uint8_t fresh[SNOW_VI_DRBG_SEED_SIZE];
+
+  if (seed == NULL) {
+    if (getentropy(fresh, sizeof(fresh)) != 0) {
+      return -1;
+    }
+    seed = fresh;
+  }
+
+  rekey(drbg, seed);
+  drbg->generated = 0;
+  drbg->fork_gen = atomic_load(&fork_gen);
+  snow_vi_wipe(fresh, sizeof(fresh));
+  return 0;
+}
+
+
+int snow_vi_drbg_generate(struct snow_vi_drbg *drbg, uint8_t *out, size_t len) {
+  if ((drbg->fork_gen != atomic_load_explicit(&fork_gen, memory_order_relaxed)) &&
+      (snow_vi_drbg_reseed(drbg, NULL) != 0)) {
+    return -1;
+  }
+
+  // Requests larger than the interval are served in parts, with a
+  // reseed between them. An interval of zero is taken as one byte.
+  uint64_t interval = (drbg->reseed_interval > 0) ? drbg->reseed_interval : 1;
+
+  while (len > 0) {
+    uint64_t n;
+
+    if (drbg->generated >= interval) {
+      if (snow_vi_drbg_reseed(drbg, NULL) != 0) {
+	return -1;
+      }
+    }
+
+    n = interval - drbg->generated;
+    if (n > len) {
+      n = len;
+    }
+
+    generate(drbg, out, (size_t) n);
+    drbg->generated += n;
+    out += n;
+    len -= (size_t) n;
+  }
+
+  // Forward secrecy: the state after the request cannot reproduce its
+  // output.
+  rekey(drbg, NULL);
+  return 0;
+}
+
+
+int snow_vi_random(uint8_t *out, size_t len) {
+  if (!thread_seeded) {
+    uint8_t seed[SNOW_VI_DRBG_SEED_SIZE];
+
+    if (getentropy(seed, sizeof(seed)) != 0) {
+      return -1;
+    }
+    snow_vi_drbg_init(&thread_drbg, &seed[0], &seed[32]);
+    snow_vi_wipe(seed, sizeof(seed));
+    thread_seeded = 1;
+
+    pthread_once(&thread_key_once, thread_key_create);
+    pthread_setspecific(thread_key, &thread_drbg);
+  }
+
+  return snow_vi_drbg_generate(&thread_drbg, out, len);
+}
+
+//=======================================================================
+// EOF snow_vi_drbg.c
+//=======================================================================
@@ -0,0 +1,107 @@
+//=======================================================================
+// snow_vi_drbg.h
+// --------------
+// Deterministic random bit generator built on the multi-stream
+// engine. The generator runs SNOW_VI_MULTI_LANES streams with the
+// same key and ivs that differ in the last byte, and large requests
+// are written by the lanes directly into the output buffer.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_drbg_h
+#define snow_vi_drbg_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "snow_vi_multi.h"
+
+// Bytes generated before the generator reseeds itself from the
+// system entropy source.
+#ifndef SNOW_VI_DRBG_RESEED_INTERVAL
+#define SNOW_VI_DRBG_RESEED_INTERVAL ((uint64_t) 1 << 32)
+#endif
+
+// Bytes of seed, a 256 bit key followed by a 128 bit iv.
+#define SNOW_VI_DRBG_SEED_SIZE 48
+
+struct snow_vi_drbg {
+  struct snow_vi_multi m;
+
+  // One block from each lane, for requests that are not a multiple of
+  // a block per lane. buf_pos bytes of it have been used.
+  uint8_t buf[16 * SNOW_VI_MULTI_LANES];
+  size_t buf_pos;
+
+  // Bytes generated since seeding, and the number of bytes after
+  // which to reseed, which may be changed after init. Zero is taken
+  // as one, a reseed before every byte.
+  uint64_t generated;
+  uint64_t reseed_interval;
+
+  // Fork generation at seeding. A child process sees a different
+  // generation and reseeds before producing any output.
+  unsigned int fork_gen;
+};
+
+// Seed the generator with a key and iv. The output is deterministic
+// until the first reseed, which happens after reseed_interval bytes or
+// in a forked child.
+void snow_vi_drbg_init(struct snow_vi_drbg *drbg, const uint8_t *key,
+		       const uint8_t *iv);
+
+// Wipe the state of the generator.
+void snow_vi_drbg_destroy(struct snow_vi_drbg *drbg);
+
+// Mix SNOW_VI_DRBG_SEED_SIZE bytes of seed with the output of the
+// generator into a new key and iv. If seed is NULL it is taken from
+// the system entropy source. Returns 0 on success and -1 if the system
+// entropy source failed.
+int snow_vi_drbg_reseed(struct snow_vi_drbg *drbg, const uint8_t *seed);
+
+// Write len random bytes to out. The generator then replaces its key
+// with its own output, so that its state does not reveal the bytes
+// already written. Returns 0 on success and -1 if a required reseed
+// failed.
+int snow_vi_drbg_generate(struct snow_vi_drbg *drbg, uint8_t *out, size_t len);
+
+// Write len random bytes to out from a generator owned by the calling
+// thread, seeded from the system entropy source on first use and
+// wiped when the thread exits. Threads never share state, so there is
+// no locking. Returns 0 on success and
+// -1 if the system entropy source failed.
+int snow_vi_random(uint8_t *out, size_t len);
+
+#endif // snow_vi_drbg_h
+
+//=======================================================================
+// EOF snow_vi_drbg.h
+//=======================================================================
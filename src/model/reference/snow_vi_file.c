@@ -0,0 +1,274 @@
+//=======================================================================
+// snow_vi_file.c
+// --------------
+// Chunked container format for encrypted files. Threads claim runs of
+// up to SNOW_VI_MULTI_LANES chunks, initialize their contexts with
+// snow_vi_init_batch() and then process the chunks one by one.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+#include "snow_vi_file.h"
+
+#define MAX_THREADS 64
+
+static const uint8_t file_magic[7] = {'S', 'N', 'O', 'W', '-', 'V', 'i'};
+
+// Decryption of the data range [first, last) from in to out, where in
+// and out point to the start of the data and out to the position of
+// byte first.
+struct file_job {
+  const uint8_t *key;
+  const uint8_t *iv_base;
+  uint64_t chunk_size;
+  const uint8_t *in;
+  uint8_t *out;
+  uint64_t first;
+  uint64_t last;
+
+  uint64_t end_chunk;
+  _Atomic uint64_t next_chunk;
+};
+
+
+static void store_le(uint8_t *p, uint64_t x, int n) {
+  for (int i = 0 ; i < n ; i++) {
+    p[i] = (uint8_t) (x >> (8 * i));
+  }
+}
+
+
+static uint64_t load_le(const uint8_t *p, int n) {
+  uint64_t x = 0;
+
+  for (int i = 0 ; i < n ; i++) {
+    x |= (uint64_t) p[i] << (8 * i);
+  }
+  return x;
+}
+
+
+// Check the fields of a header that the format restricts.
+static int check_header(const struct snow_vi_file_header *hdr) {
+  if ((hdr->chunk_size == 0) || ((hdr->chunk_size % 16) != 0) ||
+      (snow_vi_check_iv_base(hdr->iv_base) != 0)) {
+    return -1;
+  }
+  return 0;
+}
+
+
+void snow_vi_file_write_header(const struct snow_vi_file_header *hdr, uint8_t *out) {
+  memcpy(&out[0], file_magic, 7);
+  out[7] = SNOW_VI_FILE_VERSION;
+  store_le(&out[8], hdr->chunk_size, 4);
+  store_le(&out[12], 0, 4);
+  store_le(&out[16], hdr->data_len, 8);
+  memcpy(&out[24], hdr->iv_base, 16);
+}
+
+
+int snow_vi_file_read_header(struct snow_vi_file_header *hdr, const uint8_t *in,
+			     size_t len) {
+  if ((len < SNOW_VI_FILE_HEADER_SIZE) || (memcmp(&in[0], file_magic, 7) != 0) ||
+      (in[7] != SNOW_VI_FILE_VERSION) || (load_le(&in[12], 4) != 0)) {
+    return -1;
+  }
+
+  hdr->chunk_size = (uint32_t) load_le(&in[8], 4);
+  hdr->data_len = load_le(&in[16], 8);
+  memcpy(hdr->iv_base, &in[24], 16);
+  return check_header(hdr);
+}
+
+
+// Skip the first n bytes of keystream of a chunk.
+static void skip_keystream(struct snow_vi_ctx *ctx, uint64_t n) {
+  uint8_t buf[256];
+
+  while (n > 0) {
+    size_t len = n < sizeof(buf) ? (size_t) n : sizeof(buf);
+    snow_vi_keystream(ctx, buf, len);
+    n -= len;
+  }
+}
+
+
+static void *file_worker(void *arg) {
+  struct file_job *job = arg;
+  struct snow_vi_ctx ctxs[SNOW_VI_MULTI_LANES];
+  uint8_t ivs[SNOW_VI_MULTI_LANES][16];
+  const uint8_t *keys[SNOW_VI_MULTI_LANES];
+  const uint8_t *iv_ptr[SNOW_VI_MULTI_LANES];
+
+  for (int i = 0 ; i < SNOW_VI_MULTI_LANES ; i++) {
+    keys[i] = job->key;
+    iv_ptr[i] = ivs[i];
+  }
+
+  for (;;) {
+    uint64_t chunk = atomic_fetch_add(&job->next_chunk, SNOW_VI_MULTI_LANES);
+    if (chunk >= job->end_chunk) {
+      break;
+    }
+
+    size_t count = SNOW_VI_MULTI_LANES;
+    if (job->end_chunk - chunk < count) {
+      count = (size_t) (job->end_chunk - chunk);
+    }
+
+    for (size_t i = 0 ; i < count ; i++) {
+      snow_vi_derive_iv(job->iv_base, chunk + i, ivs[i]);
+    }
+    snow_vi_init_batch(ctxs, keys, iv_ptr, count);
+
+    for (size_t i = 0 ; i < count ; i++) {
+      uint64_t start = (chunk + i) * job->chunk_size;
+      uint64_t end = start + job->chunk_size;
+      uint64_t pos = start < job->first ? job->first : start;
+
+      if (end > job->last) {
+	end = job->last;
+      }
+
+      skip_keystream(&ctxs[i], pos - start);
+      snow_vi_xor(&ctxs[i], &job->in[pos], &job->out[pos - job->first],
+		  (size_t) (end - pos));
+    }
+  }
+
+  memset(ctxs, 0, sizeof(ctxs));
+  return NULL;
+}
+
+
+// Process the data range [first, last) with up to num_threads threads,
+// the calling thread being one of them.
+static void file_run(const struct snow_vi_file_header *hdr, const uint8_t *key,
+		     const uint8_t *in, uint8_t *out, uint64_t first,
+		     uint64_t last, int num_threads) {
+  struct file_job job;
+  pthread_t threads[MAX_THREADS];
+  int started = 0;
+
+  if (first >= last) {
+    return;
+  }
+
+  job.key = key;
+  job.iv_base = hdr->iv_base;
+  job.chunk_size = hdr->chunk_size;
+  job.in = in;
+  job.out = out;
+  job.first = first;
+  job.last = last;
+  job.end_chunk = (last - 1) / hdr->chunk_size + 1;
+  atomic_init(&job.next_chunk, first / hdr->chunk_size);
+
+  // More threads than runs of chunks would have nothing to do.
+  uint64_t runs = (job.end_chunk - first / hdr->chunk_size + SNOW_VI_MULTI_LANES - 1) /
+    SNOW_VI_MULTI_LANES;
+  if ((uint64_t) num_threads > runs) {
+    num_threads = (int) runs;
+  }
+  if (num_threads > MAX_THREADS) {
+    num_threads = MAX_THREADS;
+  }
+
+  // If a thread can not be created, the others do its share.
+  while (started < num_threads - 1) {
+    if (pthread_create(&threads[started], NULL, file_worker, &job) != 0) {
+      break;
+    }
+    started++;
+  }
+
+  file_worker(&job);
+  for (int i = 0 ; i < started ; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+
+int snow_vi_file_encrypt(const struct snow_vi_file_header *hdr, const uint8_t *key,
+			 const uint8_t *in, uint8_t *out, int num_threads) {
+  if (check_header(hdr) != 0) {
+    return -1;
+  }
+
+  snow_vi_file_write_header(hdr, out);
+  file_run(hdr, key, in, &out[SNOW_VI_FILE_HEADER_SIZE], 0, hdr->data_len,
+	   num_threads);
+  return 0;
+}
+
+
+int snow_vi_file_decrypt(const uint8_t *key, const uint8_t *in, size_t in_len,
+			 uint8_t *out, int num_threads) {
+  struct snow_vi_file_header hdr;
+
+  if ((snow_vi_file_read_header(&hdr, in, in_len) != 0) ||
+      (hdr.data_len != in_len - SNOW_VI_FILE_HEADER_SIZE)) {
+    return -1;
+  }
+
+  file_run(&hdr, key, &in[SNOW_VI_FILE_HEADER_SIZE], out, 0, hdr.data_len,
+	   num_threads);
+  return 0;
+}
+
+
+int snow_vi_file_decrypt_range(const uint8_t *key, const uint8_t *in, size_t in_len,
+			       uint64_t first, uint64_t last, uint8_t *out,
+			       int num_threads) {
+  struct snow_vi_file_header hdr;
+
+  if ((snow_vi_file_read_header(&hdr, in, in_len) != 0) ||
+      (hdr.data_len != in_len - SNOW_VI_FILE_HEADER_SIZE) ||
+      (first > last) || (last > hdr.data_len)) {
+    return -1;
+  }
+
+  file_run(&hdr, key, &in[SNOW_VI_FILE_HEADER_SIZE], out, first, last,
+	   num_threads);
+  return 0;
+}
+
+//=======================================================================
+// EOF snow_vi_file.c
+//=======================================================================
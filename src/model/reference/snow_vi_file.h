@@ -0,0 +1,111 @@
+//=======================================================================
+// snow_vi_file.h
+// --------------
+// Chunked container format for encrypted files. The data is split into
+// chunks of a fixed size, each encrypted as a separate stream with its
+// own iv, so that chunks can be processed in parallel and any byte
+// range can be decrypted without processing the data before it.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_file_h
+#define snow_vi_file_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "snow_vi.h"
+
+// The container is a header followed by the encrypted data, with the
+// same length as the plaintext. All integers are little endian.
+//
+//  0  8 bytes  magic "SNOW-Vi" and the format version
+//  8  4 bytes  chunk size in bytes, a multiple of 16
+// 12  4 bytes  reserved, zero
+// 16  8 bytes  length of the data in bytes
+// 24 16 bytes  iv base, the last 8 bytes zero
+//
+// Chunk i covers data bytes [i * chunk size, (i + 1) * chunk size),
+// the last chunk may be shorter. Its iv is snow_vi_derive_iv() of the
+// iv base and i. No chunk table is stored, the position and iv of
+// every chunk follow from the chunk size and the data length. The iv
+// base must never be used twice with the same key, and its last 8
+// bytes are reserved for the chunk index, so that different bases
+// never share a chunk iv. A random base has 64 random bits.
+#define SNOW_VI_FILE_VERSION 1
+#define SNOW_VI_FILE_HEADER_SIZE 40
+#define SNOW_VI_FILE_DEFAULT_CHUNK (64 * 1024)
+
+struct snow_vi_file_header {
+  uint32_t chunk_size;
+  uint64_t data_len;
+  uint8_t iv_base[16];
+};
+
+// Write the header to out, which must have room for
+// SNOW_VI_FILE_HEADER_SIZE bytes.
+void snow_vi_file_write_header(const struct snow_vi_file_header *hdr, uint8_t *out);
+
+// Parse the header from the first len bytes of in. Returns 0 on
+// success and -1 if the header is truncated, has the wrong magic or
+// version, non-zero reserved bytes, an invalid chunk size or an iv
+// base with non-zero chunk index bytes.
+int snow_vi_file_read_header(struct snow_vi_file_header *hdr, const uint8_t *in,
+			     size_t len);
+
+// Encrypt hdr->data_len bytes from in and write the container, header
+// and encrypted data, to out. out must have room for
+// SNOW_VI_FILE_HEADER_SIZE + hdr->data_len bytes. The chunks are
+// spread over up to num_threads threads. Returns 0 on success and -1,
+// without writing out, if the chunk size or iv base is invalid.
+int snow_vi_file_encrypt(const struct snow_vi_file_header *hdr, const uint8_t *key,
+			 const uint8_t *in, uint8_t *out, int num_threads);
+
+// Decrypt the container of in_len bytes in and write the data to
+// out, which must have room for the data length given in the header.
+// Returns 0 on success and -1 if the header is invalid or does not
+// match in_len.
+int snow_vi_file_decrypt(const uint8_t *key, const uint8_t *in, size_t in_len,
+			 uint8_t *out, int num_threads);
+
+// Decrypt the data bytes [first, last) of the container of in_len
+// bytes in and write them to out. Only the chunks covering the range
+// are initialized. Returns 0 on success and -1 if the header is
+// invalid or the range is outside of the data.
+int snow_vi_file_decrypt_range(const uint8_t *key, const uint8_t *in, size_t in_len,
+			       uint64_t first, uint64_t last, uint8_t *out,
+			       int num_threads);
+
+#endif // snow_vi_file_h
+
+//=======================================================================
+// EOF snow_vi_file.h
+//=======================================================================
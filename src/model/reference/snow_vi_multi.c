@@ -0,0 +1,746 @@
+//=======================================================================
+// snow_vi_multi.c
+// ---------------
+// Multi-stream engine. One stream is limited by the latency of the
+// dependency chain r1 -> r2 -> r3 through the AES rounds. Advancing
+// independent streams together lets their AES rounds and LFSR updates
+// overlap, so the throughput per core grows with the number of streams.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#include <stdatomic.h>
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_aes_round.h"
+#include "snow_vi_cpu.h"
+#include "snow_vi_multi.h"
+
+#if SNOW_VI_X86
+#include <immintrin.h>
+#endif
+
+
+// Index of word i of the LFSRs of a context.
+static inline int lfsr_index(const struct snow_vi_ctx *ctx, int i) {
+#if defined(SNOW_VI_LFSR_RING)
+  return (ctx->lfsr_head + i) & 0x0f;
+#else
+  (void) ctx;
+  return i;
+#endif
+}
+
+
+void snow_vi_multi_get_lane(const struct snow_vi_multi *m, int lane,
+			    struct snow_vi_ctx *ctx) {
+#if defined(SNOW_VI_LFSR_RING)
+  ctx->lfsr_head = 0;
+#endif
+  ctx->ks_pos = 0;
+
+  for (int i = 0 ; i < 16 ; i++) {
+    ctx->lfsr_a[i] = m->lfsr_a[i / 8][lane][i % 8];
+    ctx->lfsr_b[i] = m->lfsr_b[i / 8][lane][i % 8];
+  }
+
+  memcpy(ctx->r1, m->r1[lane], 16);
+  memcpy(ctx->r2, m->r2[lane], 16);
+  memcpy(ctx->r3, m->r3[lane], 16);
+}
+
+
+void snow_vi_multi_set_lane(struct snow_vi_multi *m, int lane,
+			    const struct snow_vi_ctx *ctx) {
+  for (int i = 0 ; i < 16 ; i++) {
+    m->lfsr_a[i / 8][lane][i % 8] = ctx->lfsr_a[lfsr_index(ctx, i)];
+    m->lfsr_b[i / 8][lane][i % 8] = ctx->lfsr_b[lfsr_index(ctx, i)];
+  }
+
+  memcpy(m->r1[lane], ctx->r1, 16);
+  memcpy(m->r2[lane], ctx->r2, 16);
+  memcpy(m->r3[lane], ctx->r3, 16);
+}
+
+
+// Portable initialization, runs each lane through the single stream
+// model.
+static void multi_init_generic(struct snow_vi_multi *m, int lanes,
+			       const uint8_t *const key[], const uint8_t *const iv[]) {
+  struct snow_vi_ctx ctx;
+
+  memset(m, 0, sizeof(*m));
+  m->lanes = lanes;
+
+  for (int l = 0 ; l < lanes ; l++) {
+    snow_vi_init(&ctx, key[l], iv[l]);
+    snow_vi_multi_set_lane(m, l, &ctx);
+  }
+}
+
+
+// Portable version, runs each lane in turn through the single stream
+// model.
+void snow_vi_multi_keystream_generic(struct snow_vi_multi *m, uint8_t *const out[],
+				     size_t n) {
+  struct snow_vi_ctx ctx;
+
+  for (int l = 0 ; l < m->lanes ; l++) {
+    snow_vi_multi_get_lane(m, l, &ctx);
+    snow_vi_keystream(&ctx, out[l], 16 * n);
+    snow_vi_multi_set_lane(m, l, &ctx);
+  }
+}
+
+
+// The byte permutation sigma applied to the new r1.
+static const uint8_t sigma[16] = {0, 4, 8, 12, 1, 5, 9, 13,
+				  2, 6, 10, 14, 3, 7, 11, 15};
+
+_Static_assert(2 * SNOW_VI_MULTI_LANES <= AES_BS_LANES,
+	       "the bitsliced round must hold r1 and r2 of all lanes");
+
+
+// Multiply a by x in GF(2^16), as gmul() in snow_vi.c.
+static inline uint16_t lane_gmul(uint16_t a, uint16_t b) {
+  uint16_t mask = (uint16_t) (0 - (a >> 15));
+
+  return (uint16_t) (a << 1) ^ (b & mask);
+}
+
+
+// Word i of the four 32-bit words in eight 16-bit LFSR words.
+static inline uint32_t lane_u32(const uint16_t *w, int i) {
+  return (uint32_t) w[2 * i] | ((uint32_t) w[(2 * i) + 1] << 16);
+}
+
+
+// Constant time version for CPUs without AES-NI and SSSE3, where the
+// single stream model would use the slow portable AES round. The LFSRs and the FSM
+// additions are done per lane, the two AES rounds of all lanes, r1 and
+// r2 of up to 16 lanes, in one pass of the bitsliced round.
+void snow_vi_multi_keystream_bs(struct snow_vi_multi *m, uint8_t *const out[],
+				size_t n) {
+  const uint8_t *aes_in[AES_BS_LANES];
+  uint8_t *aes_out[AES_BS_LANES];
+  struct aes_bs_state state;
+  uint32_t next_r1[4];
+  uint32_t z[4];
+  uint16_t u[8];
+  uint16_t v[8];
+  int lanes = m->lanes;
+
+  for (int l = 0 ; l < lanes ; l++) {
+    aes_in[l] = (const uint8_t *) m->r2[l];
+    aes_in[lanes + l] = (const uint8_t *) m->r1[l];
+    aes_out[l] = (uint8_t *) m->r3[l];
+    aes_out[lanes + l] = (uint8_t *) m->r2[l];
+  }
+
+  for (size_t i = 0 ; i < n ; i++) {
+    aes_bs_pack(&state, aes_in, 2 * lanes);
+
+    for (int l = 0 ; l < lanes ; l++) {
+      uint16_t *a_lo = m->lfsr_a[0][l];
+      uint16_t *a_hi = m->lfsr_a[1][l];
+      uint16_t *b_lo = m->lfsr_b[0][l];
+      uint16_t *b_hi = m->lfsr_b[1][l];
+      uint8_t *src = (uint8_t *) next_r1;
+      uint8_t *dst = (uint8_t *) m->r1[l];
+
+      // z = (t1 + r1) ^ r2 and r1 = sigma((t2 ^ r3) + r2), with
+      // t1 = b_hi and t2 = a_hi.
+      for (int w = 0 ; w < 4 ; w++) {
+	z[w] = (lane_u32(b_hi, w) + m->r1[l][w]) ^ m->r2[l][w];
+	next_r1[w] = (lane_u32(a_hi, w) ^ m->r3[l][w]) + m->r2[l][w];
+      }
+      memcpy(&out[l][16 * i], z, 16);
+
+      for (int k = 0 ; k < 16 ; k++) {
+	dst[k] = src[sigma[k]];
+      }
+
+      // Eight LFSR steps, a[k + 7] is a_lo[7] for k = 0, a_hi[k - 1]
+      // otherwise.
+      for (int k = 0 ; k < 8 ; k++) {
+	uint16_t a_7 = (k == 0) ? a_lo[7] : a_hi[k - 1];
+
+	u[k] = lane_gmul(a_lo[k], 0x4a6d) ^ a_7 ^ b_lo[k];
+	v[k] = lane_gmul(b_lo[k], 0xcc87) ^ b_hi[k] ^ a_lo[k];
+      }
+
+      memcpy(a_lo, a_hi, 16);
+      memcpy(b_lo, b_hi, 16);
+      memcpy(a_hi, u, 16);
+      memcpy(b_hi, v, 16);
+    }
+
+    // r3 = aes(r2) and r2 = aes(r1) of the state before the update.
+    aes_round_bs(&state);
+    aes_bs_unpack(&state, aes_out, 2 * lanes);
+  }
+}
+
+
+enum multi_engine {MULTI_UNRESOLVED, MULTI_AVX512, MULTI_AVX2, MULTI_BS, MULTI_GENERIC};
+
+// The engine for this CPU, resolved on the first call so that the CPU
+// is not queried for every request.
+static atomic_int multi_engine;
+
+static int multi_engine_select(void) {
+  if (snow_vi_cpu_has_avx2() && snow_vi_cpu_has_aesni()) {
+    return snow_vi_cpu_has_avx512_vaes() ? MULTI_AVX512 : MULTI_AVX2;
+  }
+
+#if !defined(SNOW_VI_AES_TABLE)
+  if (!snow_vi_cpu_has_aesni() && !snow_vi_cpu_has_ssse3()) {
+    return MULTI_BS;
+  }
+#endif
+
+  return MULTI_GENERIC;
+}
+
+
+static int multi_engine_get(void) {
+  int engine = atomic_load_explicit(&multi_engine, memory_order_relaxed);
+
+  if (engine == MULTI_UNRESOLVED) {
+    engine = multi_engine_select();
+    atomic_store_explicit(&multi_engine, engine, memory_order_relaxed);
+  }
+  return engine;
+}
+
+
+#if SNOW_VI_X86
+// The state of a pair of lanes in AVX2 registers. Each register holds
+// lane 2p in the low and lane 2p + 1 in the high 128 bits. All byte
+// shifts and shuffles below work within 128 bit halves, so they act on
+// each lane separately, as in the single stream SSE2 code.
+struct lane_pair {
+  __m256i a_lo, a_hi, b_lo, b_hi;
+  __m256i r1, r2, r3;
+};
+
+
+__attribute__((target("avx2,aes")))
+static inline void pair_load(const struct snow_vi_multi *m, int p, struct lane_pair *s) {
+  s->a_lo = _mm256_load_si256((const __m256i *) m->lfsr_a[0][2 * p]);
+  s->a_hi = _mm256_load_si256((const __m256i *) m->lfsr_a[1][2 * p]);
+  s->b_lo = _mm256_load_si256((const __m256i *) m->lfsr_b[0][2 * p]);
+  s->b_hi = _mm256_load_si256((const __m256i *) m->lfsr_b[1][2 * p]);
+  s->r1 = _mm256_load_si256((const __m256i *) m->r1[2 * p]);
+  s->r2 = _mm256_load_si256((const __m256i *) m->r2[2 * p]);
+  s->r3 = _mm256_load_si256((const __m256i *) m->r3[2 * p]);
+}
+
+
+__attribute__((target("avx2,aes")))
+static inline void pair_store(struct snow_vi_multi *m, int p, const struct lane_pair *s) {
+  _mm256_store_si256((__m256i *) m->lfsr_a[0][2 * p], s->a_lo);
+  _mm256_store_si256((__m256i *) m->lfsr_a[1][2 * p], s->a_hi);
+  _mm256_store_si256((__m256i *) m->lfsr_b[0][2 * p], s->b_lo);
+  _mm256_store_si256((__m256i *) m->lfsr_b[1][2 * p], s->b_hi);
+  _mm256_store_si256((__m256i *) m->r1[2 * p], s->r1);
+  _mm256_store_si256((__m256i *) m->r2[2 * p], s->r2);
+  _mm256_store_si256((__m256i *) m->r3[2 * p], s->r3);
+}
+
+
+// The keyless AES round on both lanes.
+__attribute__((target("avx2,aes")))
+static inline __m256i aes_round_pair(__m256i x) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_aesenc_si128(_mm256_castsi256_si128(x), zero);
+  __m128i hi = _mm_aesenc_si128(_mm256_extracti128_si256(x, 1), zero);
+
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+
+// gmul() on sixteen 16-bit lanes.
+__attribute__((target("avx2,aes")))
+static inline __m256i gmul_x16(__m256i a, __m256i b) {
+  __m256i mask = _mm256_srai_epi16(a, 15);
+
+  return _mm256_xor_si256(_mm256_slli_epi16(a, 1), _mm256_and_si256(b, mask));
+}
+
+
+// z = (t1 + r1) ^ r2 of both lanes, with t1 = b_hi.
+__attribute__((target("avx2,aes")))
+static inline __m256i pair_z(const struct lane_pair *s) {
+  return _mm256_xor_si256(_mm256_add_epi32(s->b_hi, s->r1), s->r2);
+}
+
+
+// Update both lanes to the next state.
+__attribute__((target("avx2,aes")))
+static inline void pair_clock(struct lane_pair *s) {
+  const __m256i sigma = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13,
+					 2, 6, 10, 14, 3, 7, 11, 15,
+					 0, 4, 8, 12, 1, 5, 9, 13,
+					 2, 6, 10, 14, 3, 7, 11, 15);
+  __m256i next_r1, a_7, u, v;
+
+  // FSM, with t2 = a_hi.
+  next_r1 = _mm256_add_epi32(_mm256_xor_si256(s->a_hi, s->r3), s->r2);
+  s->r3 = aes_round_pair(s->r2);
+  s->r2 = aes_round_pair(s->r1);
+  s->r1 = _mm256_shuffle_epi8(next_r1, sigma);
+
+  // Eight LFSR steps, a_7 is a[7..14].
+  a_7 = _mm256_or_si256(_mm256_srli_si256(s->a_lo, 14), _mm256_slli_si256(s->a_hi, 2));
+  u = _mm256_xor_si256(gmul_x16(s->a_lo, _mm256_set1_epi16(0x4a6d)),
+		       _mm256_xor_si256(a_7, s->b_lo));
+  v = _mm256_xor_si256(gmul_x16(s->b_lo, _mm256_set1_epi16((short) 0xcc87)),
+		       _mm256_xor_si256(s->b_hi, s->a_lo));
+
+  s->a_lo = s->a_hi;
+  s->b_lo = s->b_hi;
+  s->a_hi = u;
+  s->b_hi = v;
+}
+
+
+// Write the keystream block of both lanes, then update the pair to
+// the next state.
+__attribute__((target("avx2,aes")))
+static inline void pair_next(struct lane_pair *s, uint8_t *out0, uint8_t *out1) {
+  __m256i z = pair_z(s);
+
+  _mm_storeu_si128((__m128i *) out0, _mm256_castsi256_si128(z));
+  _mm_storeu_si128((__m128i *) out1, _mm256_extracti128_si256(z, 1));
+  pair_clock(s);
+}
+
+
+// Initialization round i of both lanes. z is fed back into the upper
+// half of lfsr_a, and k[i - 14] added to r1 in the last two rounds.
+__attribute__((target("avx2,aes")))
+static inline void pair_init_round(struct lane_pair *s, const __m256i k[2], int i) {
+  __m256i z = pair_z(s);
+
+  pair_clock(s);
+  s->a_hi = _mm256_xor_si256(s->a_hi, z);
+  if (i >= 14) {
+    s->r1 = _mm256_xor_si256(s->r1, k[i - 14]);
+  }
+}
+
+
+// The state stays in registers for all n blocks. Lanes are processed
+// four at a time, both pairs are advanced in the same iteration, giving
+// eight independent AES rounds per block to hide the latency of each.
+__attribute__((target("avx2,aes")))
+void snow_vi_multi_keystream_avx2(struct snow_vi_multi *m, uint8_t *const out[],
+				  size_t n) {
+  struct lane_pair s0, s1;
+  int p = 0;
+
+  for ( ; p + 2 <= m->lanes / 2 ; p += 2) {
+    pair_load(m, p, &s0);
+    pair_load(m, p + 1, &s1);
+
+    for (size_t i = 0 ; i < n ; i++) {
+      pair_next(&s0, &out[2 * p][16 * i], &out[2 * p + 1][16 * i]);
+      pair_next(&s1, &out[2 * p + 2][16 * i], &out[2 * p + 3][16 * i]);
+    }
+
+    pair_store(m, p, &s0);
+    pair_store(m, p + 1, &s1);
+  }
+
+  if (p < m->lanes / 2) {
+    pair_load(m, p, &s0);
+    for (size_t i = 0 ; i < n ; i++) {
+      pair_next(&s0, &out[2 * p][16 * i], &out[2 * p + 1][16 * i]);
+    }
+    pair_store(m, p, &s0);
+  }
+}
+
+
+// The state of four lanes in AVX-512 registers, lane 4q + j in the
+// 128 bit part j. As for the pairs, all byte shifts and shuffles work
+// within 128 bit parts, and vaesenc does one AES round on each part.
+struct lane_quad {
+  __m512i a_lo, a_hi, b_lo, b_hi;
+  __m512i r1, r2, r3;
+};
+
+
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline void quad_load(const struct snow_vi_multi *m, int q, struct lane_quad *s) {
+  s->a_lo = _mm512_load_si512(m->lfsr_a[0][4 * q]);
+  s->a_hi = _mm512_load_si512(m->lfsr_a[1][4 * q]);
+  s->b_lo = _mm512_load_si512(m->lfsr_b[0][4 * q]);
+  s->b_hi = _mm512_load_si512(m->lfsr_b[1][4 * q]);
+  s->r1 = _mm512_load_si512(m->r1[4 * q]);
+  s->r2 = _mm512_load_si512(m->r2[4 * q]);
+  s->r3 = _mm512_load_si512(m->r3[4 * q]);
+}
+
+
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline void quad_store(struct snow_vi_multi *m, int q, const struct lane_quad *s) {
+  _mm512_store_si512(m->lfsr_a[0][4 * q], s->a_lo);
+  _mm512_store_si512(m->lfsr_a[1][4 * q], s->a_hi);
+  _mm512_store_si512(m->lfsr_b[0][4 * q], s->b_lo);
+  _mm512_store_si512(m->lfsr_b[1][4 * q], s->b_hi);
+  _mm512_store_si512(m->r1[4 * q], s->r1);
+  _mm512_store_si512(m->r2[4 * q], s->r2);
+  _mm512_store_si512(m->r3[4 * q], s->r3);
+}
+
+
+// gmul() on thirty-two 16-bit lanes.
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline __m512i gmul_x32(__m512i a, __m512i b) {
+  __m512i mask = _mm512_srai_epi16(a, 15);
+
+  return _mm512_xor_si512(_mm512_slli_epi16(a, 1), _mm512_and_si512(b, mask));
+}
+
+
+// z = (t1 + r1) ^ r2 of the four lanes, with t1 = b_hi.
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline __m512i quad_z(const struct lane_quad *s) {
+  return _mm512_xor_si512(_mm512_add_epi32(s->b_hi, s->r1), s->r2);
+}
+
+
+// Update the four lanes to the next state.
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline void quad_clock(struct lane_quad *s) {
+  const __m512i sigma = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13,
+							      2, 6, 10, 14, 3, 7, 11, 15));
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i next_r1, a_7, u, v;
+
+  // FSM, with t2 = a_hi.
+  next_r1 = _mm512_add_epi32(_mm512_xor_si512(s->a_hi, s->r3), s->r2);
+  s->r3 = _mm512_aesenc_epi128(s->r2, zero);
+  s->r2 = _mm512_aesenc_epi128(s->r1, zero);
+  s->r1 = _mm512_shuffle_epi8(next_r1, sigma);
+
+  // Eight LFSR steps, a_7 is a[7..14].
+  a_7 = _mm512_or_si512(_mm512_bsrli_epi128(s->a_lo, 14), _mm512_bslli_epi128(s->a_hi, 2));
+  u = _mm512_xor_si512(gmul_x32(s->a_lo, _mm512_set1_epi16(0x4a6d)),
+		       _mm512_xor_si512(a_7, s->b_lo));
+  v = _mm512_xor_si512(gmul_x32(s->b_lo, _mm512_set1_epi16((short) 0xcc87)),
+		       _mm512_xor_si512(s->b_hi, s->a_lo));
+
+  s->a_lo = s->a_hi;
+  s->b_lo = s->b_hi;
+  s->a_hi = u;
+  s->b_hi = v;
+}
+
+
+// Write the keystream block of the four lanes at offset pos of out[0]
+// to out[3], then update them to the next state.
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline void quad_next(struct lane_quad *s, uint8_t *const out[], size_t pos) {
+  __m512i z = quad_z(s);
+
+  _mm_storeu_si128((__m128i *) &out[0][pos], _mm512_extracti32x4_epi32(z, 0));
+  _mm_storeu_si128((__m128i *) &out[1][pos], _mm512_extracti32x4_epi32(z, 1));
+  _mm_storeu_si128((__m128i *) &out[2][pos], _mm512_extracti32x4_epi32(z, 2));
+  _mm_storeu_si128((__m128i *) &out[3][pos], _mm512_extracti32x4_epi32(z, 3));
+  quad_clock(s);
+}
+
+
+// Initialization round i of the four lanes, as pair_init_round().
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline void quad_init_round(struct lane_quad *s, const __m512i k[2], int i) {
+  __m512i z = quad_z(s);
+
+  quad_clock(s);
+  s->a_hi = _mm512_xor_si512(s->a_hi, z);
+  if (i >= 14) {
+    s->r1 = _mm512_xor_si512(s->r1, k[i - 14]);
+  }
+}
+
+
+// Run nq groups of four lanes, starting at group q0, together for n
+// blocks. nq is a constant at each call, so the inner loop is unrolled
+// and the state kept in registers.
+__attribute__((target("avx512f,avx512bw,vaes")))
+static inline void quads_keystream(struct snow_vi_multi *m, int q0, int nq,
+				   uint8_t *const out[], size_t n) {
+  struct lane_quad s[4];
+
+  for (int q = 0 ; q < nq ; q++) {
+    quad_load(m, q0 + q, &s[q]);
+  }
+
+  for (size_t i = 0 ; i < n ; i++) {
+    for (int q = 0 ; q < nq ; q++) {
+      quad_next(&s[q], &out[4 * (q0 + q)], 16 * i);
+    }
+  }
+
+  for (int q = 0 ; q < nq ; q++) {
+    quad_store(m, q0 + q, &s[q]);
+  }
+}
+
+
+__attribute__((target("avx512f,avx512bw,vaes")))
+void snow_vi_multi_keystream_avx512(struct snow_vi_multi *m, uint8_t *const out[],
+				    size_t n) {
+  switch (m->lanes) {
+  case 16:
+    quads_keystream(m, 0, 4, out, n);
+    break;
+
+  case 8:
+    quads_keystream(m, 0, 2, out, n);
+    break;
+
+  case 4:
+    quads_keystream(m, 0, 1, out, n);
+    break;
+
+  default:
+    snow_vi_multi_keystream_avx2(m, out, n);
+  }
+}
+
+
+// Load the keys and ivs in the structure of arrays layout. The key
+// halves that are added to r1 in the last two initialization rounds
+// are stored in the same layout in k. The byte copies into the 16-bit
+// LFSR words rely on the little endian byte order of x86.
+static void multi_load(struct snow_vi_multi *m, int lanes,
+		       const uint8_t *const key[], const uint8_t *const iv[],
+		       uint8_t k[2][SNOW_VI_MULTI_LANES][16]) {
+  memset(m, 0, sizeof(*m));
+  m->lanes = lanes;
+
+  for (int l = 0 ; l < lanes ; l++) {
+    memcpy(m->lfsr_a[0][l], iv[l], 16);
+    memcpy(m->lfsr_a[1][l], key[l], 16);
+    memcpy(m->lfsr_b[1][l], &key[l][16], 16);
+    memcpy(k[0][l], key[l], 16);
+    memcpy(k[1][l], &key[l][16], 16);
+  }
+}
+
+
+// Initialization rounds of all lanes with AVX2, two pairs at a time.
+__attribute__((target("avx2,aes")))
+static void multi_init_avx2(struct snow_vi_multi *m,
+			    uint8_t k[2][SNOW_VI_MULTI_LANES][16]) {
+  struct lane_pair s0, s1;
+  __m256i k0[2], k1[2];
+  int p = 0;
+
+  for ( ; p + 2 <= m->lanes / 2 ; p += 2) {
+    pair_load(m, p, &s0);
+    pair_load(m, p + 1, &s1);
+    for (int h = 0 ; h < 2 ; h++) {
+      k0[h] = _mm256_load_si256((const __m256i *) k[h][2 * p]);
+      k1[h] = _mm256_load_si256((const __m256i *) k[h][2 * p + 2]);
+    }
+
+    for (int i = 0 ; i < 16 ; i++) {
+      pair_init_round(&s0, k0, i);
+      pair_init_round(&s1, k1, i);
+    }
+
+    pair_store(m, p, &s0);
+    pair_store(m, p + 1, &s1);
+  }
+
+  if (p < m->lanes / 2) {
+    pair_load(m, p, &s0);
+    for (int h = 0 ; h < 2 ; h++) {
+      k0[h] = _mm256_load_si256((const __m256i *) k[h][2 * p]);
+    }
+
+    for (int i = 0 ; i < 16 ; i++) {
+      pair_init_round(&s0, k0, i);
+    }
+    pair_store(m, p, &s0);
+  }
+}
+
+
+// Initialization rounds of all lanes with AVX-512, all groups of four
+// lanes together. The number of lanes must be a multiple of four.
+__attribute__((target("avx512f,avx512bw,vaes")))
+static void multi_init_avx512(struct snow_vi_multi *m,
+			      uint8_t k[2][SNOW_VI_MULTI_LANES][16]) {
+  struct lane_quad s[SNOW_VI_MULTI_LANES / 4];
+  __m512i kq[SNOW_VI_MULTI_LANES / 4][2];
+  int nq = m->lanes / 4;
+
+  for (int q = 0 ; q < nq ; q++) {
+    quad_load(m, q, &s[q]);
+    kq[q][0] = _mm512_load_si512(k[0][4 * q]);
+    kq[q][1] = _mm512_load_si512(k[1][4 * q]);
+  }
+
+  for (int i = 0 ; i < 16 ; i++) {
+    for (int q = 0 ; q < nq ; q++) {
+      quad_init_round(&s[q], kq[q], i);
+    }
+  }
+
+  for (int q = 0 ; q < nq ; q++) {
+    quad_store(m, q, &s[q]);
+  }
+}
+
+
+// Initialize the lanes with the widest engine the CPU supports.
+// Returns zero if there is none.
+static int multi_init_simd(struct snow_vi_multi *m, int lanes,
+			   const uint8_t *const key[], const uint8_t *const iv[]) {
+  _Alignas(64) uint8_t k[2][SNOW_VI_MULTI_LANES][16];
+  int engine = multi_engine_get();
+
+  if ((engine != MULTI_AVX512) && (engine != MULTI_AVX2)) {
+    return 0;
+  }
+
+  multi_load(m, lanes, key, iv, k);
+  if ((engine == MULTI_AVX512) && ((lanes % 4) == 0)) {
+    multi_init_avx512(m, k);
+  }
+  else {
+    multi_init_avx2(m, k);
+  }
+
+  return 1;
+}
+
+#else
+void snow_vi_multi_keystream_avx2(struct snow_vi_multi *m, uint8_t *const out[],
+				  size_t n) {
+  snow_vi_multi_keystream_generic(m, out, n);
+}
+
+
+void snow_vi_multi_keystream_avx512(struct snow_vi_multi *m, uint8_t *const out[],
+				    size_t n) {
+  snow_vi_multi_keystream_generic(m, out, n);
+}
+
+
+static int multi_init_simd(struct snow_vi_multi *m, int lanes,
+			   const uint8_t *const key[], const uint8_t *const iv[]) {
+  (void) m;
+  (void) lanes;
+  (void) key;
+  (void) iv;
+
+  return 0;
+}
+#endif
+
+
+int snow_vi_multi_init(struct snow_vi_multi *m, int lanes,
+		       const uint8_t *const key[], const uint8_t *const iv[]) {
+  if ((lanes < 2) || (lanes > SNOW_VI_MULTI_LANES) || ((lanes & (lanes - 1)) != 0)) {
+    return -1;
+  }
+
+  if (!multi_init_simd(m, lanes, key, iv)) {
+    multi_init_generic(m, lanes, key, iv);
+  }
+  return 0;
+}
+
+
+// The contexts are initialized in groups of up to SNOW_VI_MULTI_LANES.
+// A last group that does not fill a supported lane count is padded
+// with copies of its last key and iv, and the padding lanes dropped.
+void snow_vi_init_batch(struct snow_vi_ctx ctxs[], const uint8_t *const keys[],
+			const uint8_t *const ivs[], size_t n) {
+  _Alignas(64) struct snow_vi_multi m;
+  const uint8_t *key[SNOW_VI_MULTI_LANES];
+  const uint8_t *iv[SNOW_VI_MULTI_LANES];
+
+  while (n > 0) {
+    int count = (n < SNOW_VI_MULTI_LANES) ? (int) n : SNOW_VI_MULTI_LANES;
+    int lanes = 2;
+
+    while (lanes < count) {
+      lanes *= 2;
+    }
+
+    for (int l = 0 ; l < lanes ; l++) {
+      key[l] = keys[(l < count) ? l : count - 1];
+      iv[l] = ivs[(l < count) ? l : count - 1];
+    }
+
+    snow_vi_multi_init(&m, lanes, key, iv);
+    for (int l = 0 ; l < count ; l++) {
+      snow_vi_multi_get_lane(&m, l, &ctxs[l]);
+    }
+
+    ctxs += count;
+    keys += count;
+    ivs += count;
+    n -= (size_t) count;
+  }
+}
+
+
+void snow_vi_multi_keystream(struct snow_vi_multi *m, uint8_t *const out[], size_t n) {
+  switch (multi_engine_get()) {
+  case MULTI_AVX512:
+    snow_vi_multi_keystream_avx512(m, out, n);
+    break;
+
+  case MULTI_AVX2:
+    snow_vi_multi_keystream_avx2(m, out, n);
+    break;
+
+  case MULTI_BS:
+    snow_vi_multi_keystream_bs(m, out, n);
+    break;
+
+  default:
+    snow_vi_multi_keystream_generic(m, out, n);
+  }
+}
+
+//=======================================================================
+// EOF snow_vi_multi.c
+//=======================================================================
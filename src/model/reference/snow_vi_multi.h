@@ -0,0 +1,108 @@
+//=======================================================================
+// snow_vi_multi.h
+// ---------------
+// Interface for the multi-stream engine that advances several
+// independent SNOW-Vi streams together.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_multi_h
+#define snow_vi_multi_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "snow_vi.h"
+
+#define SNOW_VI_MULTI_LANES 16
+
+// State of up to SNOW_VI_MULTI_LANES independent streams in structure
+// of arrays layout. Each field holds the value of all lanes next to
+// each other, lfsr_a[h][l] is half h (words 8h..8h+7) of the lfsr_a of
+// lane l. A 256 bit register then holds one field of a pair of lanes
+// and a 512 bit register one field of four lanes, with one lane in
+// each 128 bit part.
+struct snow_vi_multi {
+  _Alignas(64) uint16_t lfsr_a[2][SNOW_VI_MULTI_LANES][8];
+  uint16_t lfsr_b[2][SNOW_VI_MULTI_LANES][8];
+
+  uint32_t r1[SNOW_VI_MULTI_LANES][4];
+  uint32_t r2[SNOW_VI_MULTI_LANES][4];
+  uint32_t r3[SNOW_VI_MULTI_LANES][4];
+
+  int lanes;
+};
+
+// Initialize lanes streams, where lanes is 2, 4, 8 or 16, from the
+// given keys and ivs. The initialization rounds of all lanes run
+// together in the SIMD engines. Returns 0 on success and -1 if the
+// lane count is not supported, in which case m is not changed.
+int snow_vi_multi_init(struct snow_vi_multi *m, int lanes,
+		       const uint8_t *const key[], const uint8_t *const iv[]);
+
+// Initialize the n contexts in ctxs from keys and ivs, with the same
+// result as snow_vi_init() on each. Groups of contexts are initialized
+// in parallel lanes of the multi-stream engines.
+void snow_vi_init_batch(struct snow_vi_ctx ctxs[], const uint8_t *const keys[],
+			const uint8_t *const ivs[], size_t n);
+
+// Copy a single stream between a lane and a context. The context must
+// not have a partially consumed keystream block.
+void snow_vi_multi_get_lane(const struct snow_vi_multi *m, int lane,
+			    struct snow_vi_ctx *ctx);
+void snow_vi_multi_set_lane(struct snow_vi_multi *m, int lane,
+			    const struct snow_vi_ctx *ctx);
+
+// Generate the next n keystream blocks of every lane, 16 * n bytes of
+// lane l are written to out[l]. snow_vi_multi_keystream() uses the
+// widest engine the CPU supports, and the bitsliced variant on CPUs
+// without AES-NI and SSSE3. The bitsliced variant is portable and constant time,
+// it runs the AES rounds of all lanes in one pass of aes_round_bs(),
+// which costs the same for 2 lanes as for 16. The AVX-512 variant advances four
+// lanes per register with VAES and handles 2 lanes with the AVX2
+// variant. The SIMD variants must only be called directly on CPUs
+// with the required features, AVX-512F, AVX-512BW and VAES for the
+// AVX-512 variant, and AVX2 and AES-NI for both.
+void snow_vi_multi_keystream(struct snow_vi_multi *m, uint8_t *const out[], size_t n);
+void snow_vi_multi_keystream_generic(struct snow_vi_multi *m, uint8_t *const out[],
+				     size_t n);
+void snow_vi_multi_keystream_bs(struct snow_vi_multi *m, uint8_t *const out[],
+				size_t n);
+void snow_vi_multi_keystream_avx2(struct snow_vi_multi *m, uint8_t *const out[],
+				  size_t n);
+void snow_vi_multi_keystream_avx512(struct snow_vi_multi *m, uint8_t *const out[],
+				    size_t n);
+
+#endif // snow_vi_multi_h
+
+//=======================================================================
+// EOF snow_vi_multi.h
+//=======================================================================
@@ -0,0 +1,185 @@
+//=======================================================================
+// snow_vi_pool.c
+// --------------
+// Pool of prepared contexts. Workers claim runs of upcoming packet
+// numbers and initialize them with snow_vi_init_batch() directly in
+// their ring slots, outside of the lock. The lock is only held to
+// claim work and to hand out ready contexts.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+#include "snow_vi_pool.h"
+
+
+static void *pool_worker(void *arg) {
+  struct snow_vi_pool *pool = arg;
+  uint8_t ivs[SNOW_VI_MULTI_LANES][16];
+  const uint8_t *keys[SNOW_VI_MULTI_LANES];
+  const uint8_t *iv_ptr[SNOW_VI_MULTI_LANES];
+
+  for (int i = 0 ; i < SNOW_VI_MULTI_LANES ; i++) {
+    keys[i] = pool->key;
+    iv_ptr[i] = ivs[i];
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stop) {
+    uint64_t first = pool->issued;
+    size_t slot = (size_t) (first % pool->depth);
+    size_t count = (size_t) (pool->next + pool->depth - first);
+
+    if (count == 0) {
+      pthread_cond_wait(&pool->space_cond, &pool->lock);
+      continue;
+    }
+
+    // Claim a run that does not wrap around the ring.
+    if (count > SNOW_VI_MULTI_LANES) {
+      count = SNOW_VI_MULTI_LANES;
+    }
+    if (count > pool->depth - slot) {
+      count = pool->depth - slot;
+    }
+    pool->issued += count;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0 ; i < count ; i++) {
+      snow_vi_derive_iv(pool->iv_base, first + i, ivs[i]);
+    }
+    snow_vi_init_batch(&pool->ctxs[slot], keys, iv_ptr, count);
+
+    pthread_mutex_lock(&pool->lock);
+    memset(&pool->ready[slot], 1, count);
+    pthread_cond_broadcast(&pool->ready_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+int snow_vi_pool_start(struct snow_vi_pool *pool, const uint8_t *key,
+		       const uint8_t *iv_base, uint64_t first_seq,
+		       size_t depth, int num_workers) {
+  memset(pool, 0, sizeof(*pool));
+  memcpy(pool->key, key, 32);
+  memcpy(pool->iv_base, iv_base, 16);
+  pool->depth = depth;
+  pool->next = first_seq;
+  pool->issued = first_seq;
+
+  if ((depth == 0) || (num_workers < 1) || (num_workers > SNOW_VI_POOL_MAX_WORKERS) ||
+      (snow_vi_check_iv_base(iv_base) != 0)) {
+    snow_vi_wipe(pool->key, sizeof(pool->key));
+    return -1;
+  }
+
+  pool->ctxs = aligned_alloc(_Alignof(struct snow_vi_ctx), depth * sizeof(struct snow_vi_ctx));
+  pool->ready = calloc(depth, 1);
+  if ((pool->ctxs == NULL) || (pool->ready == NULL)) {
+    free(pool->ctxs);
+    free(pool->ready);
+    snow_vi_wipe(pool->key, sizeof(pool->key));
+    return -1;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->ready_cond, NULL);
+  pthread_cond_init(&pool->space_cond, NULL);
+
+  for (int i = 0 ; i < num_workers ; i++) {
+    if (pthread_create(&pool->workers[i], NULL, pool_worker, pool) != 0) {
+      snow_vi_pool_stop(pool);
+      return -1;
+    }
+    pool->num_workers++;
+  }
+
+  return 0;
+}
+
+
+void snow_vi_pool_get(struct snow_vi_pool *pool, struct snow_vi_ctx *ctx,
+		      uint64_t *seq) {
+  size_t slot;
+
+  pthread_mutex_lock(&pool->lock);
+  slot = (size_t) (pool->next % pool->depth);
+  while (!pool->ready[slot]) {
+    pthread_cond_wait(&pool->ready_cond, &pool->lock);
+  }
+
+  *ctx = pool->ctxs[slot];
+  pool->ready[slot] = 0;
+  if (seq != NULL) {
+    *seq = pool->next;
+  }
+  pool->next++;
+
+  pthread_cond_broadcast(&pool->space_cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+void snow_vi_pool_stop(struct snow_vi_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->space_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0 ; i < pool->num_workers ; i++) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->space_cond);
+  pthread_cond_destroy(&pool->ready_cond);
+  pthread_mutex_destroy(&pool->lock);
+
+  // The prepared contexts are as secret as the key.
+  snow_vi_wipe(pool->ctxs, pool->depth * sizeof(pool->ctxs[0]));
+  snow_vi_wipe(pool->key, sizeof(pool->key));
+  free(pool->ctxs);
+  free(pool->ready);
+  pool->ctxs = NULL;
+  pool->ready = NULL;
+  pool->num_workers = 0;
+}
+
+//=======================================================================
+// EOF snow_vi_pool.c
+//=======================================================================
@@ -0,0 +1,98 @@
+//=======================================================================
+// snow_vi_pool.h
+// --------------
+// Pool of prepared contexts for predictable iv sequences. Worker
+// threads run the initialization for the upcoming packet numbers ahead
+// of time, so getting a context for a packet is a dequeue.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_pool_h
+#define snow_vi_pool_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "snow_vi.h"
+
+#define SNOW_VI_POOL_MAX_WORKERS 64
+
+// The iv for packet number seq is snow_vi_derive_iv(iv_base, seq).
+// The last 8 bytes of iv_base are reserved for seq and must be zero.
+struct snow_vi_pool {
+  uint8_t key[32];
+  uint8_t iv_base[16];
+
+  // Ring of depth contexts, the context for seq is in slot
+  // seq % depth. ready[slot] is set when it has been initialized.
+  struct snow_vi_ctx *ctxs;
+  uint8_t *ready;
+  size_t depth;
+
+  // next is the packet number of the next context handed out and
+  // issued the first packet number not yet claimed by a worker.
+  uint64_t next;
+  uint64_t issued;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready_cond;
+  pthread_cond_t space_cond;
+  pthread_t workers[SNOW_VI_POOL_MAX_WORKERS];
+  int num_workers;
+  int stop;
+};
+
+// Start a pool for the given key and iv base, preparing up to depth
+// contexts ahead, starting with packet number first_seq, with
+// num_workers threads. Returns 0 on success and -1 if the last 8 bytes
+// of iv_base are not zero or memory or threads could not be
+// allocated.
+int snow_vi_pool_start(struct snow_vi_pool *pool, const uint8_t *key,
+		       const uint8_t *iv_base, uint64_t first_seq,
+		       size_t depth, int num_workers);
+
+// Get the initialized context for the next packet number, waiting
+// for it if the workers have not yet prepared it. The packet number is
+// written to seq, if not NULL.
+void snow_vi_pool_get(struct snow_vi_pool *pool, struct snow_vi_ctx *ctx,
+		      uint64_t *seq);
+
+// Stop the workers, wipe the key and the prepared contexts, and free
+// the pool.
+void snow_vi_pool_stop(struct snow_vi_pool *pool);
+
+
+#endif // snow_vi_pool_h
+
+//=======================================================================
+// EOF snow_vi_pool.h
+//=======================================================================
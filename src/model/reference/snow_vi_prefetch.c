@@ -0,0 +1,257 @@
+//=======================================================================
+// snow_vi_prefetch.c
+// ------------------
+// Keystream prefetch ring. The producer writes runs of blocks with
+// snow_vi_keystream() and publishes them with a release store of head.
+// The consumer reads head with acquire, XORs from the published blocks
+// and hands them back with a release store of tail.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_prefetch.h"
+
+// Times a side yields on a full or empty ring before it sleeps.
+#define SPIN_LIMIT 64
+
+
+// Sleep on cond until the ring is no longer full, for the producer, or
+// empty, for the consumer, or the prefetch is stopped. The waiting
+// flag is set before the counter is checked again, and the other side
+// publishes its counter before it checks the flag, so either this
+// side sees the new counter or the other side signals.
+static void ring_wait(struct snow_vi_prefetch *pf, pthread_cond_t *cond,
+		      atomic_int *waiting, int producer) {
+  pthread_mutex_lock(&pf->lock);
+  atomic_store(waiting, 1);
+  for (;;) {
+    uint64_t head = atomic_load(&pf->head);
+    uint64_t tail = atomic_load(&pf->tail);
+
+    if (atomic_load(&pf->stop) ||
+	(producer ? (head - tail != pf->depth) : (head != tail))) {
+      break;
+    }
+    pthread_cond_wait(cond, &pf->lock);
+  }
+  atomic_store(waiting, 0);
+  pthread_mutex_unlock(&pf->lock);
+}
+
+
+static void ring_signal(struct snow_vi_prefetch *pf, pthread_cond_t *cond,
+			atomic_int *waiting) {
+  if (atomic_load(waiting)) {
+    pthread_mutex_lock(&pf->lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&pf->lock);
+  }
+}
+
+
+static void *prefetch_producer(void *arg) {
+  struct snow_vi_prefetch *pf = arg;
+  uint64_t head = atomic_load_explicit(&pf->head, memory_order_relaxed);
+  int spins = 0;
+
+  while (!atomic_load_explicit(&pf->stop, memory_order_relaxed)) {
+    size_t slot = (size_t) (head & (pf->depth - 1));
+    size_t n;
+
+    if (head - pf->tail_cache == pf->depth) {
+      pf->tail_cache = atomic_load_explicit(&pf->tail, memory_order_acquire);
+      if (head - pf->tail_cache == pf->depth) {
+	if (++spins < SPIN_LIMIT) {
+	  sched_yield();
+	}
+	else {
+	  ring_wait(pf, &pf->space_cond, &pf->producer_waiting, 1);
+	  spins = 0;
+	}
+	continue;
+      }
+    }
+    spins = 0;
+
+    // Fill the free blocks up to the end of the ring.
+    n = (size_t) (pf->depth - (head - pf->tail_cache));
+    if (n > pf->depth - slot) {
+      n = pf->depth - slot;
+    }
+
+    snow_vi_keystream(&pf->ctx, &pf->ring[16 * slot], 16 * n);
+    head += n;
+    atomic_store(&pf->head, head);
+    ring_signal(pf, &pf->data_cond, &pf->consumer_waiting);
+  }
+
+  return NULL;
+}
+
+
+int snow_vi_prefetch_start(struct snow_vi_prefetch *pf, const struct snow_vi_ctx *ctx,
+			   size_t depth) {
+  memset(pf, 0, sizeof(*pf));
+
+  if ((depth == 0) || ((depth & (depth - 1)) != 0) || (ctx->ks_pos != 0)) {
+    return -1;
+  }
+
+  pf->ring = aligned_alloc(64, (16 * depth + 63) & ~(size_t) 63);
+  if (pf->ring == NULL) {
+    return -1;
+  }
+
+  pf->ctx = *ctx;
+  pf->depth = depth;
+  atomic_init(&pf->head, 0);
+  atomic_init(&pf->tail, 0);
+  atomic_init(&pf->underruns, 0);
+  atomic_init(&pf->stop, 0);
+  atomic_init(&pf->producer_waiting, 0);
+  atomic_init(&pf->consumer_waiting, 0);
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->space_cond, NULL);
+  pthread_cond_init(&pf->data_cond, NULL);
+
+  if (pthread_create(&pf->producer, NULL, prefetch_producer, pf) != 0) {
+    snow_vi_prefetch_stop(pf);
+    return -1;
+  }
+  pf->started = 1;
+
+  return 0;
+}
+
+
+void snow_vi_prefetch_xor(struct snow_vi_prefetch *pf, const uint8_t *in,
+			  uint8_t *out, size_t len) {
+  uint64_t tail = atomic_load_explicit(&pf->tail, memory_order_relaxed);
+
+  while (len > 0) {
+    size_t slot = (size_t) (tail & (pf->depth - 1));
+    const uint8_t *z;
+    size_t n;
+
+    if (pf->head_cache == tail) {
+      pf->head_cache = atomic_load_explicit(&pf->head, memory_order_acquire);
+      if (pf->head_cache == tail) {
+	atomic_fetch_add_explicit(&pf->underruns, 1, memory_order_relaxed);
+	for (int spins = 1 ; pf->head_cache == tail ; spins++) {
+	  if (spins < SPIN_LIMIT) {
+	    sched_yield();
+	  }
+	  else {
+	    ring_wait(pf, &pf->data_cond, &pf->consumer_waiting, 0);
+	    spins = 0;
+	  }
+	  pf->head_cache = atomic_load_explicit(&pf->head, memory_order_acquire);
+	}
+      }
+    }
+
+    // XOR from the published blocks up to the end of the ring.
+    n = (size_t) (pf->head_cache - tail);
+    if (n > pf->depth - slot) {
+      n = pf->depth - slot;
+    }
+    n = 16 * n - pf->pos;
+    if (n > len) {
+      n = len;
+    }
+
+    // Word wise, as the byte loop is not vectorized when the buffers
+    // may alias.
+    z = &pf->ring[16 * slot + pf->pos];
+    size_t i = 0;
+    for ( ; i + 8 <= n ; i += 8) {
+      uint64_t d, k;
+
+      memcpy(&d, &in[i], 8);
+      memcpy(&k, &z[i], 8);
+      d ^= k;
+      memcpy(&out[i], &d, 8);
+    }
+    for ( ; i < n ; i++) {
+      out[i] = in[i] ^ z[i];
+    }
+    in += n;
+    out += n;
+    len -= n;
+
+    tail += (pf->pos + n) / 16;
+    pf->pos = (uint8_t) ((pf->pos + n) & 15);
+    atomic_store(&pf->tail, tail);
+    ring_signal(pf, &pf->space_cond, &pf->producer_waiting);
+  }
+}
+
+
+uint64_t snow_vi_prefetch_underruns(struct snow_vi_prefetch *pf) {
+  return atomic_load_explicit(&pf->underruns, memory_order_relaxed);
+}
+
+
+void snow_vi_prefetch_stop(struct snow_vi_prefetch *pf) {
+  if (pf->ring == NULL) {
+    return;
+  }
+
+  if (pf->started) {
+    pthread_mutex_lock(&pf->lock);
+    atomic_store(&pf->stop, 1);
+    pthread_cond_broadcast(&pf->space_cond);
+    pthread_mutex_unlock(&pf->lock);
+
+    pthread_join(pf->producer, NULL);
+    pf->started = 0;
+  }
+
+  pthread_cond_destroy(&pf->data_cond);
+  pthread_cond_destroy(&pf->space_cond);
+  pthread_mutex_destroy(&pf->lock);
+
+  // Unread keystream is as secret as the state of the stream.
+  snow_vi_wipe(pf->ring, (16 * pf->depth + 63) & ~(size_t) 63);
+  snow_vi_wipe(&pf->ctx, sizeof(pf->ctx));
+  free(pf->ring);
+  pf->ring = NULL;
+}
+
+//=======================================================================
+// EOF snow_vi_prefetch.c
+//=======================================================================
@@ -0,0 +1,106 @@
+//=======================================================================
+// snow_vi_prefetch.h
+// ------------------
+// Keystream prefetch for latency sensitive senders. A producer thread
+// fills a ring of keystream blocks ahead of time, and encryption only
+// XORs data with blocks from the ring.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_prefetch_h
+#define snow_vi_prefetch_h
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "snow_vi.h"
+
+// Single producer, single consumer ring of depth keystream blocks.
+// head counts the blocks written by the producer and tail the blocks
+// consumed. Each side also keeps a copy of the other side's counter,
+// and only reloads it when the copy says the ring is full or empty.
+// The fields of each side are on their own cache lines.
+//
+// A side that finds the ring full or empty spins for a short while,
+// then sets its waiting flag and sleeps on its condition. The other
+// side only takes the lock to signal when it sees the flag set.
+struct snow_vi_prefetch {
+  struct snow_vi_ctx ctx;
+  uint8_t *ring;
+  size_t depth;
+  pthread_t producer;
+  int started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t space_cond;
+  pthread_cond_t data_cond;
+
+  _Alignas(64) _Atomic uint64_t head;
+  uint64_t tail_cache;
+  atomic_int stop;
+  atomic_int producer_waiting;
+
+  _Alignas(64) _Atomic uint64_t tail;
+  uint64_t head_cache;
+  uint8_t pos;
+  _Atomic uint64_t underruns;
+  atomic_int consumer_waiting;
+};
+
+// Start prefetching the keystream of ctx into a ring of depth blocks,
+// where depth is a power of two. The context is copied and owned by
+// the producer thread from here on. Returns 0 on success and -1 if the
+// depth is invalid or memory or the thread could not be allocated.
+int snow_vi_prefetch_start(struct snow_vi_prefetch *pf, const struct snow_vi_ctx *ctx,
+			   size_t depth);
+
+// XOR the next len bytes of keystream from the ring into in and write
+// the result to out. in and out may be the same buffer. If the ring
+// runs empty the call waits for the producer, and the underrun counter
+// is incremented.
+void snow_vi_prefetch_xor(struct snow_vi_prefetch *pf, const uint8_t *in,
+			  uint8_t *out, size_t len);
+
+// Number of times the consumer found the ring empty.
+uint64_t snow_vi_prefetch_underruns(struct snow_vi_prefetch *pf);
+
+// Stop the producer thread, wipe the ring and the context, and free
+// the ring. May also be called
+// after snow_vi_prefetch_start() failed.
+void snow_vi_prefetch_stop(struct snow_vi_prefetch *pf);
+
+#endif // snow_vi_prefetch_h
+
+//=======================================================================
+// EOF snow_vi_prefetch.h
+//=======================================================================
@@ -0,0 +1,459 @@
+//=======================================================================
+// snow_vi_sched.c
+// ---------------
+// Work-stealing session scheduler. Each worker runs the sessions of
+// its own deque newest first, and steals the oldest sessions of other
+// workers when it runs out. A worker takes up to SNOW_VI_MULTI_LANES
+// sessions at a time and runs their next jobs together in the lanes
+// of the multi-stream engine.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+#include "snow_vi_sched.h"
+
+// The worker running on this thread, if any.
+static _Thread_local struct snow_vi_sched_worker *current_worker;
+
+
+void snow_vi_session_init(struct snow_vi_session *session, const uint8_t *key,
+			  const uint8_t *iv) {
+  snow_vi_init(&session->ctx, key, iv);
+  pthread_mutex_init(&session->lock, NULL);
+  session->head = NULL;
+  session->tail = NULL;
+  session->ready = 0;
+  session->prev = NULL;
+  session->next = NULL;
+}
+
+
+void snow_vi_session_destroy(struct snow_vi_session *session) {
+  pthread_mutex_destroy(&session->lock);
+}
+
+
+static void deque_push_back(struct snow_vi_sched_worker *w, struct snow_vi_session *s) {
+  pthread_mutex_lock(&w->lock);
+  s->next = NULL;
+  s->prev = w->back;
+  if (w->back != NULL) {
+    w->back->next = s;
+  }
+  else {
+    w->front = s;
+  }
+  w->back = s;
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+static int deque_pop_back(struct snow_vi_sched_worker *w, struct snow_vi_session *out[],
+			  int max) {
+  int n = 0;
+
+  pthread_mutex_lock(&w->lock);
+  while ((n < max) && (w->back != NULL)) {
+    out[n++] = w->back;
+    w->back = w->back->prev;
+    if (w->back != NULL) {
+      w->back->next = NULL;
+    }
+    else {
+      w->front = NULL;
+    }
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return n;
+}
+
+
+static int deque_steal_front(struct snow_vi_sched_worker *w, struct snow_vi_session *out[],
+			     int max) {
+  int n = 0;
+
+  pthread_mutex_lock(&w->lock);
+  while ((n < max) && (w->front != NULL)) {
+    out[n++] = w->front;
+    w->front = w->front->next;
+    if (w->front != NULL) {
+      w->front->prev = NULL;
+    }
+    else {
+      w->back = NULL;
+    }
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return n;
+}
+
+
+// The count is raised before the push, so a worker that pops the
+// session can never lower num_ready before it was raised. A worker
+// going to sleep raises sleeping before it checks num_ready, so either
+// it sees the new session or it is signalled here.
+static void make_ready(struct snow_vi_sched *sched, struct snow_vi_sched_worker *w,
+		       struct snow_vi_session *s) {
+  atomic_fetch_add(&sched->num_ready, 1);
+  deque_push_back(w, s);
+
+  if (atomic_load(&sched->sleeping) > 0) {
+    pthread_mutex_lock(&sched->lock);
+    pthread_cond_signal(&sched->work_cond);
+    pthread_mutex_unlock(&sched->lock);
+  }
+}
+
+
+// Run the jobs of lanes sessions together. Each stream is first moved
+// to a block boundary, then the full blocks common to all jobs are
+// generated in the multi-stream engine in chunks that stay in L1, and
+// the rest of each job is run on its own.
+static void run_lanes(struct snow_vi_sched_worker *w, struct snow_vi_session *s[],
+		      struct snow_vi_job *jobs[], int lanes) {
+  uint8_t *ks[SNOW_VI_MULTI_LANES];
+  size_t pos[SNOW_VI_MULTI_LANES];
+  size_t blocks = SIZE_MAX;
+
+  for (int l = 0 ; l < lanes ; l++) {
+    struct snow_vi_ctx *ctx = &s[l]->ctx;
+
+    pos[l] = 0;
+    if (ctx->ks_pos != 0) {
+      pos[l] = 16 - ctx->ks_pos;
+      if (pos[l] > jobs[l]->len) {
+	pos[l] = jobs[l]->len;
+      }
+      snow_vi_xor(ctx, jobs[l]->in, jobs[l]->out, pos[l]);
+    }
+
+    if (ctx->ks_pos != 0) {
+      blocks = 0;
+    }
+    else if ((jobs[l]->len - pos[l]) / 16 < blocks) {
+      blocks = (jobs[l]->len - pos[l]) / 16;
+    }
+  }
+
+  if (blocks > 0) {
+    w->m.lanes = lanes;
+    for (int l = 0 ; l < lanes ; l++) {
+      snow_vi_multi_set_lane(&w->m, l, &s[l]->ctx);
+      ks[l] = w->ks[l];
+    }
+
+    while (blocks > 0) {
+      size_t n = (blocks < SNOW_VI_SCHED_CHUNK) ? blocks : SNOW_VI_SCHED_CHUNK;
+
+      snow_vi_multi_keystream(&w->m, ks, n);
+      for (int l = 0 ; l < lanes ; l++) {
+	const uint8_t *in = &jobs[l]->in[pos[l]];
+	uint8_t *out = &jobs[l]->out[pos[l]];
+
+	// Word wise, as the byte loop is not vectorized when the
+	// buffers may alias.
+	for (size_t i = 0 ; i < 16 * n ; i += 8) {
+	  uint64_t d, z;
+
+	  memcpy(&d, &in[i], 8);
+	  memcpy(&z, &ks[l][i], 8);
+	  d ^= z;
+	  memcpy(&out[i], &d, 8);
+	}
+	pos[l] += 16 * n;
+      }
+      blocks -= n;
+    }
+
+    for (int l = 0 ; l < lanes ; l++) {
+      snow_vi_multi_get_lane(&w->m, l, &s[l]->ctx);
+    }
+  }
+
+  for (int l = 0 ; l < lanes ; l++) {
+    snow_vi_xor(&s[l]->ctx, &jobs[l]->in[pos[l]], &jobs[l]->out[pos[l]],
+		jobs[l]->len - pos[l]);
+  }
+}
+
+
+// Remove the finished job from its session and report it. A session
+// with more jobs stays ready on this worker.
+static void finish_job(struct snow_vi_sched_worker *w, struct snow_vi_session *s,
+		       struct snow_vi_job *job) {
+  struct snow_vi_sched *sched = w->sched;
+  int again;
+
+  pthread_mutex_lock(&s->lock);
+  s->head = job->next;
+  if (s->head == NULL) {
+    s->tail = NULL;
+    s->ready = 0;
+  }
+  again = s->ready;
+  pthread_mutex_unlock(&s->lock);
+
+  if (job->done != NULL) {
+    job->done(job, job->arg);
+  }
+
+  if (again) {
+    make_ready(sched, w, s);
+  }
+
+  if ((atomic_fetch_sub(&sched->num_jobs, 1) == 1) &&
+      (atomic_load(&sched->waiting) > 0)) {
+    pthread_mutex_lock(&sched->lock);
+    pthread_cond_broadcast(&sched->idle_cond);
+    pthread_mutex_unlock(&sched->lock);
+  }
+}
+
+
+// Run the next job of each of the n sessions, in groups of a supported
+// lane count.
+static void run_batch(struct snow_vi_sched_worker *w, struct snow_vi_session *s[], int n) {
+  struct snow_vi_job *jobs[SNOW_VI_MULTI_LANES];
+  int i = 0;
+
+  for (int l = 0 ; l < n ; l++) {
+    pthread_mutex_lock(&s[l]->lock);
+    jobs[l] = s[l]->head;
+    pthread_mutex_unlock(&s[l]->lock);
+  }
+
+  while (n - i >= 2) {
+    int lanes = 2;
+
+    while (2 * lanes <= n - i) {
+      lanes *= 2;
+    }
+    run_lanes(w, &s[i], &jobs[i], lanes);
+    i += lanes;
+  }
+
+  if (i < n) {
+    snow_vi_xor(&s[i]->ctx, jobs[i]->in, jobs[i]->out, jobs[i]->len);
+  }
+
+  for (int l = 0 ; l < n ; l++) {
+    finish_job(w, s[l], jobs[l]);
+  }
+}
+
+
+static void *sched_worker(void *arg) {
+  struct snow_vi_sched_worker *w = arg;
+  struct snow_vi_sched *sched = w->sched;
+  struct snow_vi_session *batch[SNOW_VI_MULTI_LANES];
+
+  current_worker = w;
+
+  for (;;) {
+    int n = deque_pop_back(w, batch, SNOW_VI_MULTI_LANES);
+
+    // Steal at most half a batch, leaving work for other thieves.
+    for (int i = 1 ; (n == 0) && (i < sched->num_workers) ; i++) {
+      n = deque_steal_front(&sched->workers[(w->id + i) % sched->num_workers], batch,
+			    SNOW_VI_MULTI_LANES / 2);
+    }
+
+    if (n == 0) {
+      int done;
+
+      pthread_mutex_lock(&sched->lock);
+      atomic_fetch_add(&sched->sleeping, 1);
+      while (!sched->stop && (atomic_load(&sched->num_ready) == 0)) {
+	pthread_cond_wait(&sched->work_cond, &sched->lock);
+      }
+      atomic_fetch_sub(&sched->sleeping, 1);
+      done = sched->stop && (atomic_load(&sched->num_ready) == 0);
+      pthread_mutex_unlock(&sched->lock);
+
+      if (done) {
+	break;
+      }
+      continue;
+    }
+    atomic_fetch_sub(&sched->num_ready, (size_t) n);
+
+    run_batch(w, batch, n);
+  }
+
+  current_worker = NULL;
+  return NULL;
+}
+
+
+int snow_vi_sched_start(struct snow_vi_sched *sched, int num_threads) {
+  memset(sched, 0, sizeof(*sched));
+
+  if ((num_threads < 1) || (num_threads > SNOW_VI_SCHED_MAX_THREADS)) {
+    return -1;
+  }
+
+  sched->workers = aligned_alloc(_Alignof(struct snow_vi_sched_worker),
+				 num_threads * sizeof(struct snow_vi_sched_worker));
+  if (sched->workers == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_init(&sched->lock, NULL);
+  pthread_cond_init(&sched->work_cond, NULL);
+  pthread_cond_init(&sched->idle_cond, NULL);
+  atomic_init(&sched->next_worker, 0);
+  atomic_init(&sched->num_ready, 0);
+  atomic_init(&sched->num_jobs, 0);
+  atomic_init(&sched->sleeping, 0);
+  atomic_init(&sched->waiting, 0);
+
+  for (int i = 0 ; i < num_threads ; i++) {
+    struct snow_vi_sched_worker *w = &sched->workers[i];
+
+    w->sched = sched;
+    w->id = i;
+    w->front = NULL;
+    w->back = NULL;
+    pthread_mutex_init(&w->lock, NULL);
+  }
+
+  // The worker count is set before any worker starts, as the workers
+  // use it to find victims.
+  sched->num_workers = num_threads;
+  for (int i = 0 ; i < num_threads ; i++) {
+    if (pthread_create(&sched->workers[i].thread, NULL, sched_worker,
+		       &sched->workers[i]) != 0) {
+      pthread_mutex_lock(&sched->lock);
+      sched->stop = 1;
+      pthread_cond_broadcast(&sched->work_cond);
+      pthread_mutex_unlock(&sched->lock);
+
+      for (int j = 0 ; j < i ; j++) {
+	pthread_join(sched->workers[j].thread, NULL);
+      }
+      for (int j = 0 ; j < num_threads ; j++) {
+	pthread_mutex_destroy(&sched->workers[j].lock);
+      }
+      free(sched->workers);
+      sched->workers = NULL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+void snow_vi_sched_submit(struct snow_vi_sched *sched, struct snow_vi_session *session,
+			  struct snow_vi_job *job) {
+  struct snow_vi_sched_worker *w = current_worker;
+  int became_ready;
+
+  atomic_fetch_add(&sched->num_jobs, 1);
+
+  pthread_mutex_lock(&session->lock);
+  job->next = NULL;
+  if (session->tail != NULL) {
+    session->tail->next = job;
+  }
+  else {
+    session->head = job;
+  }
+  session->tail = job;
+  became_ready = !session->ready;
+  session->ready = 1;
+  pthread_mutex_unlock(&session->lock);
+
+  if (became_ready) {
+    if ((w == NULL) || (w->sched != sched)) {
+      unsigned int i = atomic_fetch_add_explicit(&sched->next_worker, 1,
+						 memory_order_relaxed);
+      w = &sched->workers[i % (unsigned int) sched->num_workers];
+    }
+    make_ready(sched, w, session);
+  }
+}
+
+
+// As for the workers, waiting is raised before num_jobs is checked,
+// so the last finish_job() either is seen or wakes the caller.
+void snow_vi_sched_wait(struct snow_vi_sched *sched) {
+  if (atomic_load(&sched->num_jobs) == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&sched->lock);
+  atomic_fetch_add(&sched->waiting, 1);
+  while (atomic_load(&sched->num_jobs) != 0) {
+    pthread_cond_wait(&sched->idle_cond, &sched->lock);
+  }
+  atomic_fetch_sub(&sched->waiting, 1);
+  pthread_mutex_unlock(&sched->lock);
+}
+
+
+void snow_vi_sched_stop(struct snow_vi_sched *sched) {
+  snow_vi_sched_wait(sched);
+
+  pthread_mutex_lock(&sched->lock);
+  sched->stop = 1;
+  pthread_cond_broadcast(&sched->work_cond);
+  pthread_mutex_unlock(&sched->lock);
+
+  // All workers must have exited before any deque lock is destroyed,
+  // as a running worker may still try to steal from the others.
+  for (int i = 0 ; i < sched->num_workers ; i++) {
+    pthread_join(sched->workers[i].thread, NULL);
+  }
+  for (int i = 0 ; i < sched->num_workers ; i++) {
+    pthread_mutex_destroy(&sched->workers[i].lock);
+  }
+
+  pthread_cond_destroy(&sched->idle_cond);
+  pthread_cond_destroy(&sched->work_cond);
+  pthread_mutex_destroy(&sched->lock);
+
+  free(sched->workers);
+  sched->workers = NULL;
+  sched->num_workers = 0;
+}
+
+//=======================================================================
+// EOF snow_vi_sched.c
+//=======================================================================
@@ -0,0 +1,147 @@
+//=======================================================================
+// snow_vi_sched.h
+// ---------------
+// Scheduler that encrypts jobs from many sessions on a work-stealing
+// thread pool. The jobs of a session are run in submission order,
+// and sessions ready at the same worker are batched into the lanes of
+// the multi-stream engines.
+//
+//
+// Author: Joachim Strömbergon
+// Copyright 2024 Assured AB
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following
+// disclaimer in the documentation and/or other materials provided
+// with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS “AS IS” AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+// AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//=======================================================================
+
+#ifndef snow_vi_sched_h
+#define snow_vi_sched_h
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "snow_vi.h"
+#include "snow_vi_multi.h"
+
+#define SNOW_VI_SCHED_MAX_THREADS 64
+
+// Number of keystream blocks per lane generated in one call to the
+// multi-stream engine when jobs are batched.
+#define SNOW_VI_SCHED_CHUNK 64
+
+// An encrypt or decrypt job, XOR of the session keystream into len
+// bytes of in, written to out. The job is owned by the caller and must
+// stay valid until done is called with it, from a worker thread.
+struct snow_vi_job {
+  const uint8_t *in;
+  uint8_t *out;
+  size_t len;
+  void (*done)(struct snow_vi_job *job, void *arg);
+  void *arg;
+
+  struct snow_vi_job *next;
+};
+
+// A session, one keystream and its queue of jobs. A session with
+// queued jobs is ready and is in the deque of exactly one worker, or
+// being run by it.
+struct snow_vi_session {
+  struct snow_vi_ctx ctx;
+
+  pthread_mutex_t lock;
+  struct snow_vi_job *head;
+  struct snow_vi_job *tail;
+  int ready;
+
+  struct snow_vi_session *prev;
+  struct snow_vi_session *next;
+};
+
+// A worker owns a deque of ready sessions. It takes sessions from the
+// back, other workers steal from the front.
+struct snow_vi_sched_worker {
+  struct snow_vi_sched *sched;
+  int id;
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  struct snow_vi_session *front;
+  struct snow_vi_session *back;
+
+  struct snow_vi_multi m;
+  uint8_t ks[SNOW_VI_MULTI_LANES][16 * SNOW_VI_SCHED_CHUNK];
+};
+
+struct snow_vi_sched {
+  struct snow_vi_sched_worker *workers;
+  int num_workers;
+  atomic_uint next_worker;
+
+  // Idle workers wait on work_cond for ready sessions. Callers of
+  // snow_vi_sched_wait() wait on idle_cond for outstanding jobs. The
+  // counters are atomic, and the lock is only taken to sleep, or to
+  // wake a thread that sleeping or waiting says is asleep.
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t idle_cond;
+  atomic_size_t num_ready;
+  atomic_size_t num_jobs;
+  atomic_int sleeping;
+  atomic_int waiting;
+  int stop;
+};
+
+// Initialize a session with the given key and iv.
+void snow_vi_session_init(struct snow_vi_session *session, const uint8_t *key,
+			  const uint8_t *iv);
+
+// Free the resources of a session without outstanding jobs.
+void snow_vi_session_destroy(struct snow_vi_session *session);
+
+// Start a scheduler with num_threads workers. Returns 0 on success
+// and -1 if memory or threads could not be allocated.
+int snow_vi_sched_start(struct snow_vi_sched *sched, int num_threads);
+
+// Queue a job for a session. Jobs of the same session are run in the
+// order they were submitted. A session that becomes ready is put on
+// the deque of the calling worker, or spread over the workers when
+// called from another thread.
+void snow_vi_sched_submit(struct snow_vi_sched *sched, struct snow_vi_session *session,
+			  struct snow_vi_job *job);
+
+// Wait until all submitted jobs are done.
+void snow_vi_sched_wait(struct snow_vi_sched *sched);
+
+// Wait for all submitted jobs, then stop the workers and free the
+// scheduler.
+void snow_vi_sched_stop(struct snow_vi_sched *sched);
+
+#endif // snow_vi_sched_h
+
+//=======================================================================
+// EOF snow_vi_sched.h
+//=======================================================================
@@ -36,8 +36,25 @@
 //
 //=======================================================================
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "snow_vi.h"
+#include "snow_vi_cpu.h"
+#include "snow_vi_aes_round.h"
+#include "snow_vi_multi.h"
+#include "snow_vi_pool.h"
+#include "snow_vi_prefetch.h"
+#include "snow_vi_sched.h"
+#include "snow_vi_arena.h"
+#include "snow_vi_file.h"
+#include "snow_vi_aead.h"
+#include "snow_vi_drbg.h"
 
 // Test keys and IVs
 const uint8_t key[32] = {0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57,
@@ -48,9 +65,1175 @@ const uint8_t key[32] = {0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57,
 const uint8_t iv[16] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
 			0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10};
 
+// Expected keystream for the key and IV above after the 16
+// initialization rounds, matching the output of the old reference
+// model.
+const uint8_t expected_keystream[8][16] = {
+  {0x3a, 0x40, 0xf5, 0x40, 0xf5, 0x47, 0xf0, 0x0f,
+   0x2d, 0x6f, 0xe3, 0xd0, 0x01, 0xc1, 0x40, 0x3a},
+  {0xc7, 0x05, 0x9a, 0x39, 0x19, 0x78, 0x4f, 0xab,
+   0x41, 0x4b, 0xbe, 0xf7, 0x59, 0x25, 0xe5, 0x23},
+  {0x7e, 0x12, 0x45, 0x4a, 0xea, 0x9e, 0x01, 0x1c,
+   0xe4, 0x46, 0x29, 0xad, 0xf3, 0xf7, 0xa8, 0xbb},
+  {0x7e, 0x26, 0xbd, 0x6c, 0x42, 0x95, 0xce, 0x62,
+   0x6a, 0x70, 0xb6, 0x4b, 0x41, 0x48, 0xf7, 0xb3},
+  {0xb4, 0xe2, 0x33, 0x57, 0x5a, 0xf9, 0xba, 0x7a,
+   0x76, 0x34, 0xa6, 0xbb, 0x22, 0xc7, 0x40, 0x77},
+  {0x3e, 0xbe, 0xeb, 0xed, 0x5a, 0x94, 0x94, 0xd5,
+   0x3a, 0x2b, 0x95, 0x86, 0x03, 0x0d, 0x68, 0x7d},
+  {0x28, 0xf9, 0x7e, 0xc9, 0x83, 0xfd, 0x76, 0x41,
+   0x3e, 0xd6, 0x55, 0x1b, 0xdf, 0x89, 0xf1, 0xeb},
+  {0x30, 0xc2, 0x4d, 0x1c, 0x61, 0x2d, 0x5a, 0x93,
+   0x14, 0xd7, 0x64, 0xd8, 0x22, 0x7e, 0x4d, 0xbf}};
+
+
+// Round 1 state before SubBytes and after MixColumns from
+// FIPS-197, Appendix B.
+const uint8_t aes_round_in[16] = {0x19, 0x3d, 0xe3, 0xbe, 0xa0, 0xf4, 0xe2, 0x2b,
+				  0x9a, 0xc6, 0x8d, 0x2a, 0xe9, 0xf8, 0x48, 0x08};
+
+const uint8_t aes_round_expected[16] = {0x04, 0x66, 0x81, 0xe5, 0xe0, 0xcb, 0x19, 0x9a,
+					0x48, 0xf8, 0xd3, 0x7a, 0x28, 0x06, 0x26, 0x4c};
+
+
+// Check an AES round backend against the FIPS-197 vector, and against
+// the reference implementation for a chain of rounds. The x2 and n
+// variants are checked with the same in place pattern as the FSM:
+// r3 = aes(r2), r2 = aes(r1).
+int test_aes_round_backend(const char *name,
+			   void (*round)(const uint8_t *, uint8_t *),
+			   void (*round_x2)(const uint8_t *, uint8_t *,
+					    const uint8_t *, uint8_t *),
+			   void (*round_n)(const uint8_t *, uint8_t *, int)) {
+  uint8_t ref[16];
+  uint8_t res[16];
+  uint8_t regs[3][16];
+  uint8_t blocks[5][16];
+  uint8_t expected[5][16];
+
+  round(aes_round_in, res);
+  if (memcmp(res, aes_round_expected, 16) != 0) {
+    printf("aes_round %s: FIPS-197 vector failed.\n", name);
+    return 1;
+  }
+
+  memcpy(ref, aes_round_in, 16);
+  memcpy(res, aes_round_in, 16);
+  for (int i = 0 ; i < 1000 ; i++) {
+    aes_round_ref(ref, ref);
+    round(res, res);
+    if (memcmp(res, ref, 16) != 0) {
+      printf("aes_round %s: mismatch in round %d.\n", name, i);
+      return 1;
+    }
+  }
+
+  memcpy(regs[0], aes_round_in, 16);
+  memcpy(regs[1], aes_round_expected, 16);
+  aes_round_ref(regs[0], ref);
+  aes_round_ref(regs[1], res);
+  round_x2(regs[1], regs[2], regs[0], regs[1]);
+  if ((memcmp(regs[1], ref, 16) != 0) || (memcmp(regs[2], res, 16) != 0)) {
+    printf("aes_round %s: x2 mismatch.\n", name);
+    return 1;
+  }
+
+  for (int i = 0 ; i < 5 ; i++) {
+    for (int j = 0 ; j < 16 ; j++) {
+      blocks[i][j] = aes_round_in[j] ^ (uint8_t) (i * 16 + j);
+    }
+    aes_round_ref(blocks[i], expected[i]);
+  }
+  round_n(&blocks[0][0], &blocks[0][0], 5);
+  if (memcmp(blocks, expected, sizeof(expected)) != 0) {
+    printf("aes_round %s: n mismatch.\n", name);
+    return 1;
+  }
+
+  printf("aes_round %s: ok.\n", name);
+  return 0;
+}
+
+
+// Check the bitsliced round with a full and a partial set of lanes.
+int test_aes_round_bs(int n) {
+  uint8_t ref[AES_BS_LANES][16];
+  uint8_t res[AES_BS_LANES][16];
+  const uint8_t *in[AES_BS_LANES];
+  uint8_t *out[AES_BS_LANES];
+  struct aes_bs_state state;
+
+  for (int l = 0 ; l < n ; l++) {
+    for (int i = 0 ; i < 16 ; i++) {
+      ref[l][i] = aes_round_in[i] ^ (uint8_t) (l * 17 + i);
+    }
+    in[l] = ref[l];
+    out[l] = res[l];
+  }
+
+  aes_bs_pack(&state, in, n);
+  for (int i = 0 ; i < 100 ; i++) {
+    aes_round_bs(&state);
+    for (int l = 0 ; l < n ; l++) {
+      aes_round_ref(ref[l], ref[l]);
+    }
+  }
+  aes_bs_unpack(&state, out, n);
+
+  for (int l = 0 ; l < n ; l++) {
+    if (memcmp(res[l], ref[l], 16) != 0) {
+      printf("aes_round bitsliced, %d lanes: mismatch in lane %d.\n", n, l);
+      return 1;
+    }
+  }
+
+  printf("aes_round bitsliced, %d lanes: ok.\n", n);
+  return 0;
+}
+
+
+// Check that pack and unpack ignore blocks beyond AES_BS_LANES.
+int test_aes_bs_clamp(void) {
+  uint8_t blocks[AES_BS_LANES + 1][16];
+  const uint8_t *in[AES_BS_LANES + 1];
+  uint8_t *out[AES_BS_LANES + 1];
+  struct aes_bs_state state;
+  struct aes_bs_state ref;
+
+  for (int l = 0 ; l <= AES_BS_LANES ; l++) {
+    memset(blocks[l], l, 16);
+    in[l] = blocks[l];
+    out[l] = blocks[l];
+  }
+
+  aes_bs_pack(&ref, in, AES_BS_LANES);
+  aes_bs_pack(&state, in, AES_BS_LANES + 1);
+  memset(blocks[AES_BS_LANES], 0xa5, 16);
+  aes_bs_unpack(&state, out, AES_BS_LANES + 1);
+
+  if ((memcmp(&state, &ref, sizeof(ref)) != 0) || (blocks[AES_BS_LANES][0] != 0xa5)) {
+    printf("aes_round bitsliced: block count not clamped.\n");
+    return 1;
+  }
+
+  printf("aes_round bitsliced, clamped block count: ok.\n");
+  return 0;
+}
+
+
+int test_aes_round(void) {
+  int errors = 0;
+
+  errors += test_aes_round_backend("ref", aes_round_ref,
+				   aes_round_ref_x2, aes_round_ref_n);
+  errors += test_aes_round_backend("table", aes_round_table,
+				   aes_round_table_x2, aes_round_table_n);
+  errors += test_aes_round_backend("dispatch", aes_round,
+				   aes_round_x2, aes_round_n);
+  errors += test_aes_round_bs(AES_BS_LANES);
+  errors += test_aes_round_bs(8);
+  errors += test_aes_bs_clamp();
+
+  if (snow_vi_cpu_has_ssse3()) {
+    errors += test_aes_round_backend("vperm", aes_round_vperm,
+				     aes_round_vperm_x2, aes_round_vperm_n);
+  }
+
+  if (snow_vi_cpu_has_aesni()) {
+    errors += test_aes_round_backend("aes-ni", aes_round_ni,
+				     aes_round_ni_x2, aes_round_ni_n);
+  }
+  printf("\n");
+
+  return errors;
+}
+
+
+// Generate the expected keystream in chunks of odd sizes, both with
+// snow_vi_keystream() and mixed with snow_vi_next().
+int test_keystream(void) {
+  const size_t chunks[] = {1, 15, 3, 17, 0, 32, 7, 9, 44};
+  struct snow_vi_ctx ctx;
+  uint8_t out[sizeof(expected_keystream)];
+  size_t pos = 0;
+
+  snow_vi_init(&ctx, key, iv);
+  for (size_t i = 0 ; i < sizeof(chunks) / sizeof(chunks[0]) ; i++) {
+    snow_vi_keystream(&ctx, &out[pos], chunks[i]);
+    pos += chunks[i];
+  }
+
+  if ((pos != sizeof(out)) || (memcmp(out, expected_keystream, sizeof(out)) != 0)) {
+    printf("snow_vi_keystream: chunked keystream mismatch.\n");
+    return 1;
+  }
+
+  snow_vi_init(&ctx, key, iv);
+  snow_vi_get_z(&ctx, &out[0]);
+  snow_vi_get_z(&ctx, &out[16]);
+  if ((memcmp(&out[0], expected_keystream, 16) != 0) ||
+      (memcmp(&out[16], expected_keystream, 16) != 0)) {
+    printf("snow_vi_get_z: block of the current state mismatch.\n");
+    return 1;
+  }
+
+  snow_vi_keystream(&ctx, &out[0], 5);
+  snow_vi_next(&ctx, &out[5]);
+  snow_vi_keystream(&ctx, &out[21], sizeof(out) - 21);
+  if (memcmp(out, expected_keystream, sizeof(out)) != 0) {
+    printf("snow_vi_keystream: mixed keystream mismatch.\n");
+    return 1;
+  }
+
+  printf("snow_vi_keystream: ok.\n\n");
+  return 0;
+}
+
+
+// Check snow_vi_xor() against snow_vi_keystream(), in place and in
+// chunks of odd sizes, and above the non-temporal store threshold.
+int test_xor(void) {
+  const size_t chunks[] = {3, 29, 0, 16, 1, 79};
+  const size_t big_len = SNOW_VI_XOR_NT_THRESHOLD + 35;
+  struct snow_vi_ctx ctx;
+  uint8_t buf[sizeof(expected_keystream)];
+  uint8_t *big_ks, *big_buf;
+  size_t pos = 0;
+  int errors = 0;
+
+  memset(buf, 0x5a, sizeof(buf));
+  snow_vi_init(&ctx, key, iv);
+  for (size_t i = 0 ; i < sizeof(chunks) / sizeof(chunks[0]) ; i++) {
+    snow_vi_xor(&ctx, &buf[pos], &buf[pos], chunks[i]);
+    pos += chunks[i];
+  }
+
+  for (size_t i = 0 ; i < sizeof(buf) ; i++) {
+    if ((buf[i] ^ 0x5a) != expected_keystream[i / 16][i % 16]) {
+      printf("snow_vi_xor: chunked in place mismatch at byte %zu.\n", i);
+      return 1;
+    }
+  }
+
+  big_ks = malloc(big_len);
+  big_buf = aligned_alloc(64, (big_len + 63) & ~(size_t) 63);
+  if ((big_ks == NULL) || (big_buf == NULL)) {
+    printf("snow_vi_xor: allocation failed.\n");
+    free(big_ks);
+    free(big_buf);
+    return 1;
+  }
+
+  snow_vi_init(&ctx, key, iv);
+  snow_vi_keystream(&ctx, big_ks, big_len);
+
+  for (size_t i = 0 ; i < big_len ; i++) {
+    big_buf[i] = (uint8_t) i;
+  }
+  snow_vi_init(&ctx, key, iv);
+  snow_vi_xor(&ctx, big_buf, big_buf, big_len);
+
+  for (size_t i = 0 ; i < big_len ; i++) {
+    if ((big_buf[i] ^ (uint8_t) i) != big_ks[i]) {
+      printf("snow_vi_xor: bulk mismatch at byte %zu.\n", i);
+      errors = 1;
+      break;
+    }
+  }
+
+  free(big_ks);
+  free(big_buf);
+
+  if (errors == 0) {
+    printf("snow_vi_xor: ok.\n\n");
+  }
+  return errors;
+}
+
+
+// Encrypt a buffer split into fragments of odd sizes, including empty
+// ones, and check it against the expected keystream.
+int test_xor_iov(void) {
+  const size_t frags[] = {7, 0, 1, 40, 13, 2, 65};
+  struct snow_vi_iovec iov[sizeof(frags) / sizeof(frags[0])];
+  struct snow_vi_ctx ctx;
+  uint8_t buf[sizeof(expected_keystream)];
+  size_t pos = 0;
+
+  memset(buf, 0, sizeof(buf));
+  for (size_t i = 0 ; i < sizeof(frags) / sizeof(frags[0]) ; i++) {
+    iov[i].base = &buf[pos];
+    iov[i].len = frags[i];
+    pos += frags[i];
+  }
+
+  snow_vi_init(&ctx, key, iv);
+  snow_vi_xor_iov(&ctx, iov, sizeof(frags) / sizeof(frags[0]));
+  if ((pos != sizeof(buf)) || (memcmp(buf, expected_keystream, sizeof(buf)) != 0)) {
+    printf("snow_vi_xor_iov: mismatch.\n");
+    return 1;
+  }
+
+  printf("snow_vi_xor_iov: ok.\n\n");
+  return 0;
+}
+
+
+// Serialize contexts at block boundaries and in the middle of blocks,
+// and check that restored contexts continue the keystream. Corrupted
+// headers must be rejected.
+int test_serialize(void) {
+  const size_t offsets[] = {0, 1, 16, 37, 1000};
+  struct snow_vi_ctx ctx;
+  struct snow_vi_ctx restored;
+  uint8_t state[SNOW_VI_STATE_SIZE];
+  uint8_t skip[1000];
+  uint8_t res[100];
+  uint8_t ref[100];
+
+  for (size_t o = 0 ; o < sizeof(offsets) / sizeof(offsets[0]) ; o++) {
+    snow_vi_init(&ctx, key, iv);
+    snow_vi_keystream(&ctx, skip, offsets[o]);
+    snow_vi_serialize(&ctx, state);
+
+    memset(&restored, 0xff, sizeof(restored));
+    if (snow_vi_restore(&restored, state) != 0) {
+      printf("snow_vi_restore: valid state rejected.\n");
+      return 1;
+    }
+
+    snow_vi_keystream(&ctx, ref, sizeof(ref));
+    snow_vi_keystream(&restored, res, sizeof(res));
+    if (memcmp(res, ref, sizeof(ref)) != 0) {
+      printf("snow_vi_restore: mismatch after %zu bytes.\n", offsets[o]);
+      return 1;
+    }
+  }
+
+  state[4] = SNOW_VI_STATE_VERSION + 1;
+  if (snow_vi_restore(&restored, state) != -1) {
+    printf("snow_vi_restore: wrong version accepted.\n");
+    return 1;
+  }
+  state[4] = SNOW_VI_STATE_VERSION;
+  state[5] = 16;
+  if (snow_vi_restore(&restored, state) != -1) {
+    printf("snow_vi_restore: invalid offset accepted.\n");
+    return 1;
+  }
+
+  printf("snow_vi_serialize: ok.\n\n");
+  return 0;
+}
+
+
+// Check a multi-stream engine with 2 to 16 lanes against single
+// streams. Lane 0 uses the test key and iv, the other lanes variants
+// of them. The engine is called twice to check that the state is
+// carried between calls.
+int test_multi_engine(const char *name,
+		      void (*keystream)(struct snow_vi_multi *, uint8_t *const [], size_t)) {
+  uint8_t keys[SNOW_VI_MULTI_LANES][32];
+  uint8_t ivs[SNOW_VI_MULTI_LANES][16];
+  const uint8_t *key_ptr[SNOW_VI_MULTI_LANES];
+  const uint8_t *iv_ptr[SNOW_VI_MULTI_LANES];
+  uint8_t res[SNOW_VI_MULTI_LANES][16 * 12];
+  uint8_t *out[SNOW_VI_MULTI_LANES];
+  uint8_t ref[16 * 12];
+  struct snow_vi_multi m;
+  struct snow_vi_ctx ctx;
+
+  for (int l = 0 ; l < SNOW_VI_MULTI_LANES ; l++) {
+    for (int i = 0 ; i < 32 ; i++) {
+      keys[l][i] = key[i] ^ (uint8_t) (l * 0x31);
+    }
+    for (int i = 0 ; i < 16 ; i++) {
+      ivs[l][i] = iv[i] ^ (uint8_t) (l * 0x17);
+    }
+    key_ptr[l] = keys[l];
+    iv_ptr[l] = ivs[l];
+  }
+
+  if ((snow_vi_multi_init(&m, 0, key_ptr, iv_ptr) != -1) ||
+      (snow_vi_multi_init(&m, 3, key_ptr, iv_ptr) != -1) ||
+      (snow_vi_multi_init(&m, 2 * SNOW_VI_MULTI_LANES, key_ptr, iv_ptr) != -1)) {
+    printf("snow_vi_multi_init: unsupported lane count accepted.\n");
+    return 1;
+  }
+
+  for (int lanes = 2 ; lanes <= SNOW_VI_MULTI_LANES ; lanes *= 2) {
+    if (snow_vi_multi_init(&m, lanes, key_ptr, iv_ptr) != 0) {
+      printf("snow_vi_multi_init: %d lanes rejected.\n", lanes);
+      return 1;
+    }
+    for (int l = 0 ; l < lanes ; l++) {
+      out[l] = res[l];
+    }
+    keystream(&m, out, 5);
+    for (int l = 0 ; l < lanes ; l++) {
+      out[l] = &res[l][16 * 5];
+    }
+    keystream(&m, out, 7);
+
+    for (int l = 0 ; l < lanes ; l++) {
+      snow_vi_init(&ctx, keys[l], ivs[l]);
+      snow_vi_keystream(&ctx, ref, sizeof(ref));
+      if (memcmp(res[l], ref, sizeof(ref)) != 0) {
+	printf("snow_vi_multi %s, %d lanes: mismatch in lane %d.\n", name, lanes, l);
+	return 1;
+      }
+    }
+  }
+
+  if (memcmp(res[0], expected_keystream, sizeof(expected_keystream)) != 0) {
+    printf("snow_vi_multi %s: lane 0 does not match the expected keystream.\n", name);
+    return 1;
+  }
+
+  printf("snow_vi_multi %s: ok.\n", name);
+  return 0;
+}
+
+
+// Check snow_vi_init_batch() against snow_vi_init() for batch sizes
+// that do and do not fill the lanes of the engines.
+int test_init_batch(void) {
+  const size_t sizes[] = {1, 5, 16, 21};
+  uint8_t keys[21][32];
+  uint8_t ivs[21][16];
+  const uint8_t *key_ptr[21];
+  const uint8_t *iv_ptr[21];
+  struct snow_vi_ctx ctxs[21];
+  struct snow_vi_ctx ctx;
+  uint8_t res[32];
+  uint8_t ref[32];
+
+  for (int c = 0 ; c < 21 ; c++) {
+    for (int i = 0 ; i < 32 ; i++) {
+      keys[c][i] = key[i] ^ (uint8_t) (c * 0x0b);
+    }
+    for (int i = 0 ; i < 16 ; i++) {
+      ivs[c][i] = iv[i] ^ (uint8_t) (c * 0x65);
+    }
+    key_ptr[c] = keys[c];
+    iv_ptr[c] = ivs[c];
+  }
+
+  for (size_t s = 0 ; s < sizeof(sizes) / sizeof(sizes[0]) ; s++) {
+    snow_vi_init_batch(ctxs, key_ptr, iv_ptr, sizes[s]);
+
+    for (size_t c = 0 ; c < sizes[s] ; c++) {
+      snow_vi_init(&ctx, keys[c], ivs[c]);
+      snow_vi_keystream(&ctx, ref, sizeof(ref));
+      snow_vi_keystream(&ctxs[c], res, sizeof(res));
+      if (memcmp(res, ref, sizeof(ref)) != 0) {
+	printf("snow_vi_init_batch, %zu contexts: mismatch in context %zu.\n",
+	       sizes[s], c);
+	return 1;
+      }
+    }
+  }
+
+  printf("snow_vi_init_batch: ok.\n");
+  return 0;
+}
+
+
+int test_multi(void) {
+  int errors = 0;
+
+  errors += test_multi_engine("generic", snow_vi_multi_keystream_generic);
+  errors += test_multi_engine("bitsliced", snow_vi_multi_keystream_bs);
+  errors += test_multi_engine("dispatch", snow_vi_multi_keystream);
+  errors += test_init_batch();
+
+  if (snow_vi_cpu_has_avx2() && snow_vi_cpu_has_aesni()) {
+    errors += test_multi_engine("avx2", snow_vi_multi_keystream_avx2);
+
+    if (snow_vi_cpu_has_avx512_vaes()) {
+      errors += test_multi_engine("avx512", snow_vi_multi_keystream_avx512);
+    }
+  }
+  printf("\n");
+
+  return errors;
+}
+
+
+// Get contexts from a pool with several workers and a ring smaller
+// than the number of contexts, and check them against snow_vi_init().
+int test_pool(void) {
+  struct snow_vi_pool pool;
+  struct snow_vi_ctx ctx;
+  struct snow_vi_ctx ref_ctx;
+  uint8_t iv_base[16];
+  uint8_t pkt_iv[16];
+  uint8_t res[16];
+  uint8_t ref[16];
+  uint64_t seq;
+
+  // The last 8 bytes of the iv base are reserved for the packet number.
+  if (snow_vi_pool_start(&pool, key, iv, 1000, 24, 3) != -1) {
+    printf("snow_vi_pool: iv base with packet number bytes accepted.\n");
+    return 1;
+  }
+
+  memcpy(iv_base, iv, 8);
+  memset(&iv_base[8], 0, 8);
+  if (snow_vi_pool_start(&pool, key, iv_base, 1000, 24, 3) != 0) {
+    printf("snow_vi_pool: start failed.\n");
+    return 1;
+  }
+
+  for (uint64_t i = 0 ; i < 200 ; i++) {
+    snow_vi_pool_get(&pool, &ctx, &seq);
+    snow_vi_derive_iv(pool.iv_base, seq, pkt_iv);
+    snow_vi_init(&ref_ctx, key, pkt_iv);
+    snow_vi_next(&ctx, res);
+    snow_vi_next(&ref_ctx, ref);
+
+    if ((seq != 1000 + i) || (memcmp(res, ref, 16) != 0)) {
+      printf("snow_vi_pool: mismatch for packet %llu.\n", (unsigned long long) seq);
+      snow_vi_pool_stop(&pool);
+      return 1;
+    }
+  }
+  snow_vi_pool_stop(&pool);
+
+  snow_vi_derive_iv(pool.iv_base, 0, pkt_iv);
+  if (memcmp(pkt_iv, iv_base, 16) != 0) {
+    printf("snow_vi_pool: iv for packet 0 differs from the iv base.\n");
+    return 1;
+  }
+
+  memset(res, 0, sizeof(res));
+  if ((memcmp(pool.key, res, 16) != 0) || (memcmp(&pool.key[16], res, 16) != 0)) {
+    printf("snow_vi_pool: key not wiped.\n");
+    return 1;
+  }
+
+  printf("snow_vi_pool: ok.\n\n");
+  return 0;
+}
+
+
+// Encrypt in chunks of varying sizes through a small prefetch ring,
+// and check the result against snow_vi_keystream().
+int test_prefetch(void) {
+  const size_t total = 64 * 1024;
+  const struct timespec pause = {0, 20 * 1000 * 1000};
+  struct snow_vi_prefetch pf;
+  struct snow_vi_ctx ctx;
+  uint8_t *buf, *ref;
+  size_t pos = 0;
+  int errors = 0;
+
+  snow_vi_init(&ctx, key, iv);
+  if (snow_vi_prefetch_start(&pf, &ctx, 12) != -1) {
+    printf("snow_vi_prefetch: depth that is not a power of two accepted.\n");
+    snow_vi_prefetch_stop(&pf);
+    return 1;
+  }
+  // Stopping after a failed start does nothing.
+  snow_vi_prefetch_stop(&pf);
+
+  buf = calloc(total, 1);
+  ref = malloc(total);
+  if ((buf == NULL) || (ref == NULL) || (snow_vi_prefetch_start(&pf, &ctx, 16) != 0)) {
+    printf("snow_vi_prefetch: start failed.\n");
+    free(buf);
+    free(ref);
+    return 1;
+  }
+
+  snow_vi_keystream(&ctx, ref, total);
+  for (size_t i = 0 ; pos < total ; i++) {
+    size_t n = (i * 37) % 301;
+
+    if (n > total - pos) {
+      n = total - pos;
+    }
+    snow_vi_prefetch_xor(&pf, &buf[pos], &buf[pos], n);
+    pos += n;
+
+    // Pause once, long enough for the producer to fill the ring and go
+    // to sleep.
+    if ((i == 100) && (nanosleep(&pause, NULL) != 0)) {
+      printf("snow_vi_prefetch: nanosleep failed.\n");
+    }
+  }
+  snow_vi_prefetch_stop(&pf);
+
+  memset(&ctx, 0, sizeof(ctx));
+  if (memcmp(buf, ref, total) != 0) {
+    printf("snow_vi_prefetch: mismatch.\n");
+    errors = 1;
+  }
+  else if (memcmp(&pf.ctx, &ctx, sizeof(ctx)) != 0) {
+    printf("snow_vi_prefetch: context not wiped.\n");
+    errors = 1;
+  }
+  else {
+    printf("snow_vi_prefetch: ok, %llu underruns.\n\n",
+	   (unsigned long long) snow_vi_prefetch_underruns(&pf));
+  }
+
+  free(buf);
+  free(ref);
+  return errors;
+}
+
+
+// Completion callback of the scheduler test, checks that the jobs of
+// a session are done in submission order.
+struct sched_test_job {
+  struct snow_vi_job job;
+  int index;
+  int *next_index;
+  int *errors;
+};
+
+
+static void sched_test_done(struct snow_vi_job *job, void *arg) {
+  struct sched_test_job *t = arg;
+
+  (void) job;
+  if (*t->next_index != t->index) {
+    (*t->errors)++;
+  }
+  (*t->next_index)++;
+}
+
+
+// Encrypt jobs of odd sizes from many sessions through the scheduler,
+// and check the result and the job order of each session.
+int test_sched(void) {
+  enum { SESSIONS = 37, JOBS = 9, SIZE = 16 * 50 };
+  static struct snow_vi_session s[SESSIONS];
+  static struct sched_test_job jobs[SESSIONS][JOBS];
+  static uint8_t buf[SESSIONS][SIZE];
+  static uint8_t ref[SIZE];
+  int next_index[SESSIONS];
+  struct snow_vi_sched sched;
+  struct snow_vi_ctx ctx;
+  uint8_t session_iv[16];
+  int errors = 0;
+
+  if (snow_vi_sched_start(&sched, 3) != 0) {
+    printf("snow_vi_sched: start failed.\n");
+    return 1;
+  }
+
+  memset(buf, 0, sizeof(buf));
+  for (int i = 0 ; i < SESSIONS ; i++) {
+    memcpy(session_iv, iv, 16);
+    session_iv[0] ^= (uint8_t) i;
+    snow_vi_session_init(&s[i], key, session_iv);
+    next_index[i] = 0;
+  }
+
+  // Session i splits its buffer into JOBS jobs with sizes depending
+  // on i, the last job taking the rest.
+  for (int j = 0 ; j < JOBS ; j++) {
+    for (int i = 0 ; i < SESSIONS ; i++) {
+      size_t len = (size_t) ((i * 7 + j * 13) % 90);
+      size_t start = 0;
+
+      for (int k = 0 ; k < j ; k++) {
+	start += jobs[i][k].job.len;
+      }
+      if (j == JOBS - 1) {
+	len = SIZE - start;
+      }
+
+      jobs[i][j].job.in = &buf[i][start];
+      jobs[i][j].job.out = &buf[i][start];
+      jobs[i][j].job.len = len;
+      jobs[i][j].job.done = sched_test_done;
+      jobs[i][j].job.arg = &jobs[i][j];
+      jobs[i][j].index = j;
+      jobs[i][j].next_index = &next_index[i];
+      jobs[i][j].errors = &errors;
+      snow_vi_sched_submit(&sched, &s[i], &jobs[i][j].job);
+    }
+  }
+  snow_vi_sched_stop(&sched);
+
+  if (errors != 0) {
+    printf("snow_vi_sched: jobs done out of order.\n");
+    return 1;
+  }
+
+  for (int i = 0 ; i < SESSIONS ; i++) {
+    memcpy(session_iv, iv, 16);
+    session_iv[0] ^= (uint8_t) i;
+    snow_vi_init(&ctx, key, session_iv);
+    snow_vi_keystream(&ctx, ref, SIZE);
+    snow_vi_session_destroy(&s[i]);
+
+    if ((next_index[i] != JOBS) || (memcmp(buf[i], ref, SIZE) != 0)) {
+      printf("snow_vi_sched: mismatch in session %d.\n", i);
+      return 1;
+    }
+  }
+
+  printf("snow_vi_sched: ok.\n\n");
+  return 0;
+}
+
+
+// Acquire contexts from an arena, run whole groups through the multi
+// engine and check each lane against a single stream context. Released
+// handles must be reused before the arena reports that it is full.
+int test_arena(void) {
+  struct snow_vi_arena arena;
+  struct snow_vi_ctx ctx;
+  uint8_t ivs[40][16];
+  uint32_t handles[40];
+  uint32_t handle;
+  uint8_t ks[SNOW_VI_MULTI_LANES][32];
+  uint8_t *out[SNOW_VI_MULTI_LANES];
+  uint8_t ref[32];
+  int errors = 0;
+
+  if (snow_vi_arena_create(&arena, 40) != 0) {
+    printf("snow_vi_arena: create failed.\n");
+    return 1;
+  }
+
+  for (int c = 0 ; c < 40 ; c++) {
+    for (int i = 0 ; i < 16 ; i++) {
+      ivs[c][i] = iv[i] ^ (uint8_t) (c * 0x3d);
+    }
+    if ((snow_vi_arena_acquire(&arena, key, ivs[c], &handles[c]) != 0) ||
+	(handles[c] != (uint32_t) c)) {
+      printf("snow_vi_arena: acquire %d failed.\n", c);
+      snow_vi_arena_destroy(&arena);
+      return 1;
+    }
+  }
+
+  for (int i = 0 ; i < SNOW_VI_MULTI_LANES ; i++) {
+    out[i] = ks[i];
+  }
+  for (size_t g = 0 ; g < arena.num_groups ; g++) {
+    snow_vi_multi_keystream(snow_vi_arena_group(&arena, g), out, 2);
+
+    for (int lane = 0 ; lane < SNOW_VI_MULTI_LANES ; lane++) {
+      size_t c = g * SNOW_VI_MULTI_LANES + (size_t) lane;
+      if (c >= 40) {
+	break;
+      }
+      snow_vi_init(&ctx, key, ivs[c]);
+      snow_vi_keystream(&ctx, ref, sizeof(ref));
+      if (memcmp(ks[lane], ref, sizeof(ref)) != 0) {
+	printf("snow_vi_arena: mismatch in context %zu.\n", c);
+	errors++;
+      }
+    }
+  }
+
+  // The stored state continues after the group keystream.
+  snow_vi_arena_load(&arena, handles[17], &ctx);
+  snow_vi_keystream(&ctx, ks[0], 16);
+  snow_vi_init(&ctx, key, ivs[17]);
+  snow_vi_keystream(&ctx, ref, sizeof(ref));
+  snow_vi_keystream(&ctx, ref, 16);
+  if (memcmp(ks[0], ref, 16) != 0) {
+    printf("snow_vi_arena: loaded context does not continue the keystream.\n");
+    errors++;
+  }
+
+  if ((snow_vi_arena_release(&arena, handles[5]) != 0) ||
+      (snow_vi_arena_release(&arena, handles[30]) != 0)) {
+    printf("snow_vi_arena: release failed.\n");
+    errors++;
+  }
+
+  // Handles outside of the arena, already released or never acquired
+  // are rejected without changing the free list.
+  if ((snow_vi_arena_release(&arena, 48) != -1) ||
+      (snow_vi_arena_release(&arena, UINT32_MAX) != -1) ||
+      (snow_vi_arena_release(&arena, handles[5]) != -1) ||
+      (snow_vi_arena_release(&arena, 45) != -1) || (arena.num_free != 10)) {
+    printf("snow_vi_arena: invalid release accepted.\n");
+    errors++;
+  }
+
+  for (int i = 0 ; i < 2 ; i++) {
+    snow_vi_arena_acquire(&arena, key, iv, &handle);
+    if (handle != handles[i == 0 ? 30 : 5]) {
+      printf("snow_vi_arena: released handle not reused.\n");
+      errors++;
+    }
+  }
+  while (snow_vi_arena_acquire(&arena, key, iv, &handle) == 0) {
+  }
+  if (arena.num_free != 0) {
+    printf("snow_vi_arena: acquire failed with free contexts.\n");
+    errors++;
+  }
+
+  snow_vi_arena_destroy(&arena);
+
+  if (errors == 0) {
+    printf("snow_vi_arena: ok.\n\n");
+  }
+  return errors;
+}
+
+
+// Encrypt a buffer into a container with small chunks, check each
+// chunk against a single stream context with the chunk iv, and decrypt
+// the whole container and a few byte ranges.
+int test_file(void) {
+  const uint64_t ranges[][2] = {{0, 2500}, {0, 1}, {63, 65}, {100, 1300},
+				{2499, 2500}, {700, 700}};
+  struct snow_vi_file_header hdr;
+  struct snow_vi_ctx ctx;
+  uint8_t data[2500];
+  uint8_t enc[SNOW_VI_FILE_HEADER_SIZE + 2500];
+  uint8_t dec[2500];
+  uint8_t ref[64];
+  uint8_t chunk_iv[16];
+
+  for (size_t i = 0 ; i < sizeof(data) ; i++) {
+    data[i] = (uint8_t) (i * 7 + 1);
+  }
+
+  // The last 8 bytes of the iv base are reserved for the chunk index.
+  hdr.chunk_size = 64;
+  hdr.data_len = sizeof(data);
+  memcpy(hdr.iv_base, iv, 16);
+  if (snow_vi_file_encrypt(&hdr, key, data, enc, 3) != -1) {
+    printf("snow_vi_file: iv base with chunk index bytes accepted.\n");
+    return 1;
+  }
+
+  memset(&hdr.iv_base[8], 0, 8);
+  if (snow_vi_file_encrypt(&hdr, key, data, enc, 3) != 0) {
+    printf("snow_vi_file: encryption failed.\n");
+    return 1;
+  }
+
+  for (uint64_t c = 0 ; c * 64 < sizeof(data) ; c++) {
+    size_t len = sizeof(data) - c * 64 < 64 ? sizeof(data) - c * 64 : 64;
+
+    snow_vi_derive_iv(hdr.iv_base, c, chunk_iv);
+    snow_vi_init(&ctx, key, chunk_iv);
+    snow_vi_xor(&ctx, &data[c * 64], ref, len);
+    if (memcmp(&enc[SNOW_VI_FILE_HEADER_SIZE + c * 64], ref, len) != 0) {
+      printf("snow_vi_file: mismatch in chunk %llu.\n", (unsigned long long) c);
+      return 1;
+    }
+  }
+
+  if ((snow_vi_file_decrypt(key, enc, sizeof(enc), dec, 4) != 0) ||
+      (memcmp(dec, data, sizeof(data)) != 0)) {
+    printf("snow_vi_file: decryption failed.\n");
+    return 1;
+  }
+
+  for (size_t r = 0 ; r < sizeof(ranges) / sizeof(ranges[0]) ; r++) {
+    uint64_t first = ranges[r][0];
+    uint64_t last = ranges[r][1];
+
+    memset(dec, 0, sizeof(dec));
+    if ((snow_vi_file_decrypt_range(key, enc, sizeof(enc), first, last, dec, 2) != 0) ||
+	(memcmp(dec, &data[first], (size_t) (last - first)) != 0)) {
+      printf("snow_vi_file: decryption of range [%llu, %llu) failed.\n",
+	     (unsigned long long) first, (unsigned long long) last);
+      return 1;
+    }
+  }
+
+  if (snow_vi_file_decrypt_range(key, enc, sizeof(enc), 10, 2501, dec, 1) != -1) {
+    printf("snow_vi_file: range outside of the data accepted.\n");
+    return 1;
+  }
+
+  enc[13] = 1;
+  if (snow_vi_file_decrypt(key, enc, sizeof(enc), dec, 1) != -1) {
+    printf("snow_vi_file: non-zero reserved bytes accepted.\n");
+    return 1;
+  }
+
+  enc[13] = 0;
+  enc[39] = 1;
+  if (snow_vi_file_decrypt(key, enc, sizeof(enc), dec, 1) != -1) {
+    printf("snow_vi_file: iv base with chunk index bytes accepted.\n");
+    return 1;
+  }
+
+  enc[39] = 0;
+  enc[8] = 65;
+  if (snow_vi_file_decrypt(key, enc, sizeof(enc), dec, 1) != -1) {
+    printf("snow_vi_file: invalid chunk size accepted.\n");
+    return 1;
+  }
+
+  printf("snow_vi_file: ok.\n\n");
+  return 0;
+}
+
+
+// GHASH of the GCM specification test case 2, and the PCLMULQDQ
+// backend against the generic one for lengths around the four block
+// groups.
+int test_ghash(void) {
+  const uint8_t h[16] = {0x66, 0xe9, 0x4b, 0xd4, 0xef, 0x8a, 0x2c, 0x3b,
+			 0x88, 0x4c, 0xfa, 0x59, 0xca, 0x34, 0x2b, 0x2e};
+  const uint8_t c[16] = {0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+			 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78};
+  const uint8_t expected[16] = {0xf3, 0x8c, 0xbb, 0x1a, 0xd6, 0x92, 0x23, 0xdc,
+				0xc3, 0x45, 0x7a, 0xe5, 0xb6, 0xb0, 0xf8, 0x85};
+  uint8_t data[200];
+  uint8_t res[16];
+  uint8_t ref[16];
+
+  snow_vi_ghash_generic(h, NULL, 0, c, sizeof(c), res);
+  if (memcmp(res, expected, 16) != 0) {
+    printf("snow_vi_ghash_generic: wrong result for the GCM test case.\n");
+    return 1;
+  }
+
+  if (!snow_vi_cpu_has_pclmul()) {
+    printf("snow_vi_ghash: ok, no PCLMULQDQ.\n");
+    return 0;
+  }
+
+  snow_vi_ghash_pclmul(h, NULL, 0, c, sizeof(c), res);
+  if (memcmp(res, expected, 16) != 0) {
+    printf("snow_vi_ghash_pclmul: wrong result for the GCM test case.\n");
+    return 1;
+  }
+
+  for (size_t i = 0 ; i < sizeof(data) ; i++) {
+    data[i] = (uint8_t) (i * 29 + 3);
+  }
+  for (size_t aad_len = 0 ; aad_len < 80 ; aad_len += 13) {
+    for (size_t c_len = 0 ; c_len <= 120 ; c_len++) {
+      snow_vi_ghash_generic(data, &data[80], aad_len, &data[80 - c_len / 2], c_len, ref);
+      snow_vi_ghash_pclmul(data, &data[80], aad_len, &data[80 - c_len / 2], c_len, res);
+      if (memcmp(res, ref, 16) != 0) {
+	printf("snow_vi_ghash_pclmul: mismatch for %zu + %zu bytes.\n", aad_len, c_len);
+	return 1;
+      }
+    }
+  }
+
+  printf("snow_vi_ghash: ok.\n");
+  return 0;
+}
+
+
+// Check the AEAD mode against its definition, built from
+// snow_vi_init_aead(), the keystream and GHASH, and check that a
+// modified ciphertext or tag is rejected.
+int test_aead(void) {
+  const size_t lengths[] = {0, 1, 15, 16, 63, 64, 65, 200, 1000};
+  uint8_t aad[21];
+  uint8_t msg[1000];
+  uint8_t enc[1000];
+  uint8_t dec[1000];
+  uint8_t ks[1032];
+  uint8_t tag[16];
+  uint8_t ref[16];
+  struct snow_vi_ctx ctx;
+
+  for (size_t i = 0 ; i < sizeof(aad) ; i++) {
+    aad[i] = (uint8_t) (0xa0 + i);
+  }
+  for (size_t i = 0 ; i < sizeof(msg) ; i++) {
+    msg[i] = (uint8_t) (i * 13);
+  }
+
+  for (size_t l = 0 ; l < sizeof(lengths) / sizeof(lengths[0]) ; l++) {
+    size_t len = lengths[l];
+
+    snow_vi_aead_encrypt(key, iv, aad, sizeof(aad), msg, enc, len, tag);
+
+    snow_vi_init_aead(&ctx, key, iv);
+    snow_vi_keystream(&ctx, ks, 32 + len);
+    for (size_t i = 0 ; i < len ; i++) {
+      dec[i] = msg[i] ^ ks[32 + i];
+    }
+    snow_vi_ghash_generic(ks, aad, sizeof(aad), dec, len, ref);
+    for (int i = 0 ; i < 16 ; i++) {
+      ref[i] ^= ks[16 + i];
+    }
+    if ((memcmp(enc, dec, len) != 0) || (memcmp(tag, ref, 16) != 0)) {
+      printf("snow_vi_aead_encrypt: mismatch for %zu bytes.\n", len);
+      return 1;
+    }
+
+    memcpy(dec, enc, len);
+    if ((snow_vi_aead_decrypt(key, iv, aad, sizeof(aad), dec, dec, len, tag) != 0) ||
+	(memcmp(dec, msg, len) != 0)) {
+      printf("snow_vi_aead_decrypt: failed for %zu bytes.\n", len);
+      return 1;
+    }
+
+    if (len > 0) {
+      enc[len / 2] ^= 0x10;
+      if ((snow_vi_aead_decrypt(key, iv, aad, sizeof(aad), enc, dec, len, tag) != -1) ||
+	  (dec[len / 2] != 0)) {
+	printf("snow_vi_aead_decrypt: modified ciphertext of %zu bytes accepted.\n", len);
+	return 1;
+      }
+      enc[len / 2] ^= 0x10;
+    }
+
+    tag[15] ^= 0x01;
+    if (snow_vi_aead_decrypt(key, iv, aad, sizeof(aad), enc, dec, len, tag) != -1) {
+      printf("snow_vi_aead_decrypt: modified tag accepted for %zu bytes.\n", len);
+      return 1;
+    }
+  }
+
+  printf("snow_vi_aead: ok.\n\n");
+  return 0;
+}
+
+
+// Check the lane layout of a bulk request against single stream
+// contexts, that the output only depends on the seed and requests,
+// that the key is replaced after each request, that reseeding changes
+// the output, that a forked child does not repeat the output of its
+// parent, and that destroy wipes the state.
+int test_drbg(void) {
+  struct snow_vi_drbg a, b;
+  struct snow_vi_ctx ctx;
+  uint8_t lane_iv[16];
+  uint8_t seed[SNOW_VI_DRBG_SEED_SIZE];
+  uint8_t out[3000];
+  uint8_t ref[3000];
+  int fds[2];
+  pid_t pid;
+
+  snow_vi_drbg_init(&a, key, iv);
+  snow_vi_drbg_generate(&a, out, 512);
+  for (int l = 0 ; l < SNOW_VI_MULTI_LANES ; l++) {
+    memcpy(lane_iv, iv, 16);
+    lane_iv[15] ^= (uint8_t) l;
+    snow_vi_init(&ctx, key, lane_iv);
+    snow_vi_keystream(&ctx, ref, 32);
+    if (memcmp(&out[32 * l], ref, 32) != 0) {
+      printf("snow_vi_drbg: mismatch in lane %d.\n", l);
+      return 1;
+    }
+  }
+
+  // The key is replaced after each request, so a split request
+  // continues with different output.
+  snow_vi_drbg_init(&a, key, iv);
+  snow_vi_drbg_init(&b, key, iv);
+  snow_vi_drbg_generate(&a, out, 64);
+  snow_vi_drbg_generate(&b, ref, 32);
+  snow_vi_drbg_generate(&b, &ref[32], 32);
+  if ((memcmp(out, ref, 32) != 0) || (memcmp(&out[32], &ref[32], 32) == 0)) {
+    printf("snow_vi_drbg: no rekey after a request.\n");
+    return 1;
+  }
+
+  // The same requests from the same seed, mixing small and bulk.
+  snow_vi_drbg_init(&a, key, iv);
+  snow_vi_drbg_init(&b, key, iv);
+  for (size_t pos = 0, n = 1 ; pos < sizeof(out) ; pos += n, n = 3 * n + 5) {
+    if (n > sizeof(out) - pos) {
+      n = sizeof(out) - pos;
+    }
+    snow_vi_drbg_generate(&a, &out[pos], n);
+    snow_vi_drbg_generate(&b, &ref[pos], n);
+  }
+  if (memcmp(out, ref, sizeof(out)) != 0) {
+    printf("snow_vi_drbg: output is not deterministic.\n");
+    return 1;
+  }
+
+  memset(seed, 0x5a, sizeof(seed));
+  snow_vi_drbg_reseed(&a, seed);
+  snow_vi_drbg_reseed(&b, seed);
+  snow_vi_drbg_generate(&a, out, 100);
+  snow_vi_drbg_generate(&b, ref, 100);
+  if (memcmp(out, ref, 100) != 0) {
+    printf("snow_vi_drbg: reseed with a given seed is not deterministic.\n");
+    return 1;
+  }
+
+  // b reaches its reseed interval after 900 more bytes.
+  b.reseed_interval = 1000;
+  snow_vi_drbg_generate(&a, out, 900);
+  snow_vi_drbg_generate(&a, &out[900], sizeof(out) - 900);
+  snow_vi_drbg_generate(&b, ref, sizeof(ref));
+  if ((memcmp(out, ref, 900) != 0) || (memcmp(&out[900], &ref[900], 16) == 0) ||
+      (b.generated > 1000)) {
+    printf("snow_vi_drbg: no reseed after the reseed interval.\n");
+    return 1;
+  }
+
+  // An interval of zero must not stall the generator.
+  b.reseed_interval = 0;
+  if ((snow_vi_drbg_generate(&b, ref, 10) != 0) || (b.generated != 1)) {
+    printf("snow_vi_drbg: reseed interval of zero not handled.\n");
+    return 1;
+  }
+
+  if (pipe(fds) != 0) {
+    printf("snow_vi_drbg: pipe failed.\n");
+    return 1;
+  }
+  pid = fork();
+  if (pid == 0) {
+    snow_vi_drbg_generate(&a, out, 32);
+    _exit(write(fds[1], out, 32) == 32 ? 0 : 1);
+  }
+  snow_vi_drbg_generate(&a, out, 32);
+  if ((pid < 0) || (read(fds[0], ref, 32) != 32) ||
+      (waitpid(pid, NULL, 0) != pid) || (memcmp(out, ref, 32) == 0)) {
+    printf("snow_vi_drbg: forked child repeats the output of its parent.\n");
+    return 1;
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  snow_vi_drbg_destroy(&b);
+  for (size_t i = 0 ; i < sizeof(b) ; i++) {
+    if (((const uint8_t *) &b)[i] != 0) {
+      printf("snow_vi_drbg: state not wiped.\n");
+      return 1;
+    }
+  }
+
+  if ((snow_vi_random(out, 100) != 0) || (snow_vi_random(ref, 100) != 0) ||
+      (memcmp(out, ref, 100) == 0)) {
+    printf("snow_vi_random: failed.\n");
+    return 1;
+  }
+
+  printf("snow_vi_drbg: ok.\n\n");
+  return 0;
+}
+
+
 int main(void) {
   printf("snow_vi test started.\n");
 
+  int errors = test_aes_round();
+  errors += test_keystream();
+  errors += test_xor();
+  errors += test_xor_iov();
+  errors += test_serialize();
+  errors += test_multi();
+  errors += test_pool();
+  errors += test_prefetch();
+  errors += test_sched();
+  errors += test_arena();
+  errors += test_file();
+  errors += test_ghash();
+  errors += test_aead();
+  errors += test_drbg();
+
   struct snow_vi_ctx my_ctx;
   snow_vi_init(&my_ctx, &key[0], &iv[0]);
 
@@ -69,9 +1252,26 @@ int main(void) {
   printf("State after init.\n");
   snow_vi_display_state(&my_ctx);
 
+  printf("Output keystream:\n");
+  for (int i = 0 ; i < 8 ; i++) {
+    uint8_t z[16];
+
+    snow_vi_next(&my_ctx, z);
+    for (int j = 0 ; j < 16 ; j++) {
+      printf("%02x ", z[j]);
+    }
+    printf("\n");
+
+    if (memcmp(z, expected_keystream[i], 16) != 0) {
+      printf("Keystream block %d does not match the expected value.\n", i);
+      errors++;
+    }
+  }
+  printf("\n");
+
   printf("snow_vi test completed.\n");
 
-  return 0;
+  return errors != 0;
 }
 
 //=======================================================================